@@ -24,13 +24,4 @@ namespace avrlib {
 /* static */
 uint8_t Adc::admux_value_ = ADC_DEFAULT << 6;
 
-/* static */
-uint8_t AdcInputScanner::current_pin_;
-
-/* static */
-uint8_t AdcInputScanner::num_inputs_;
-
-/* static */
-int16_t AdcInputScanner::state_[8];
-
 }  // namespace avrlib
@@ -20,7 +20,9 @@
 #ifndef AVRLIB_ADC_H_
 #define AVRLIB_ADC_H_
 
+#include <avr/interrupt.h>
 #include <avr/io.h>
+#include <string.h>
 
 #include "avrlib/avrlib.h"
 
@@ -37,10 +39,85 @@ enum AdcAlignment {
   ADC_LEFT_ALIGNED = 1
 };
 
+// Sources of conversion triggers. When a timer compare match is used, the
+// compare flag is cleared by the scanner. When a timer overflow is used, the
+// overflow interrupt must be enabled so that the flag gets cleared.
+enum AdcTriggerSource {
+  ADC_TRIGGER_FREE_RUNNING = 0,
+  ADC_TRIGGER_TIMER0_COMPARE_A = 3,
+  ADC_TRIGGER_TIMER0_OVERFLOW = 4,
+  ADC_TRIGGER_TIMER1_COMPARE_B = 5,
+  ADC_TRIGGER_TIMER1_OVERFLOW = 6,
+  ADC_TRIGGER_TIMER1_CAPTURE = 7
+};
+
+#if defined(ATMEGA640) || defined(ATMEGA1280) || defined(ATMEGA2560)
+#define HAS_ADC_MUX5
+#endif
+
+// Channel numbers 0 to 7 (0 to 15 on the ATmega640/1280/2560) are the
+// single-ended inputs. The other input configurations (differential inputs,
+// gain stage, bandgap reference...) are selected by passing the raw value of
+// the MUX bits (MUX5:0 on the ATmega640/1280/2560, MUX4:0 otherwise), or'ed
+// with ADC_RAW_MUX.
+enum AdcChannel {
+  ADC_RAW_MUX = 0x80,
+#ifdef HAS_ADC_MUX5
+  ADC_DIFF_0_0_X10 = ADC_RAW_MUX | 0x08,
+  ADC_DIFF_1_0_X10 = ADC_RAW_MUX | 0x09,
+  ADC_DIFF_0_0_X200 = ADC_RAW_MUX | 0x0a,
+  ADC_DIFF_1_0_X200 = ADC_RAW_MUX | 0x0b,
+  ADC_DIFF_2_2_X10 = ADC_RAW_MUX | 0x0c,
+  ADC_DIFF_3_2_X10 = ADC_RAW_MUX | 0x0d,
+  ADC_DIFF_2_2_X200 = ADC_RAW_MUX | 0x0e,
+  ADC_DIFF_3_2_X200 = ADC_RAW_MUX | 0x0f,
+  ADC_DIFF_0_1_X1 = ADC_RAW_MUX | 0x10,
+  ADC_DIFF_2_1_X1 = ADC_RAW_MUX | 0x12,
+  ADC_DIFF_3_1_X1 = ADC_RAW_MUX | 0x13,
+  ADC_DIFF_4_1_X1 = ADC_RAW_MUX | 0x14,
+  ADC_DIFF_5_1_X1 = ADC_RAW_MUX | 0x15,
+  ADC_DIFF_6_1_X1 = ADC_RAW_MUX | 0x16,
+  ADC_DIFF_7_1_X1 = ADC_RAW_MUX | 0x17,
+  ADC_DIFF_0_2_X1 = ADC_RAW_MUX | 0x18,
+  ADC_DIFF_1_2_X1 = ADC_RAW_MUX | 0x19,
+  ADC_DIFF_3_2_X1 = ADC_RAW_MUX | 0x1b,
+  ADC_DIFF_4_2_X1 = ADC_RAW_MUX | 0x1c,
+  ADC_DIFF_5_2_X1 = ADC_RAW_MUX | 0x1d,
+  ADC_BANDGAP = ADC_RAW_MUX | 0x1e,
+  ADC_GROUND = ADC_RAW_MUX | 0x1f,
+  ADC_DIFF_8_8_X10 = ADC_RAW_MUX | 0x28,
+  ADC_DIFF_9_8_X10 = ADC_RAW_MUX | 0x29,
+  ADC_DIFF_8_8_X200 = ADC_RAW_MUX | 0x2a,
+  ADC_DIFF_9_8_X200 = ADC_RAW_MUX | 0x2b,
+  ADC_DIFF_10_10_X10 = ADC_RAW_MUX | 0x2c,
+  ADC_DIFF_11_10_X10 = ADC_RAW_MUX | 0x2d,
+  ADC_DIFF_10_10_X200 = ADC_RAW_MUX | 0x2e,
+  ADC_DIFF_11_10_X200 = ADC_RAW_MUX | 0x2f,
+  ADC_DIFF_8_9_X1 = ADC_RAW_MUX | 0x30,
+  ADC_DIFF_10_9_X1 = ADC_RAW_MUX | 0x32,
+  ADC_DIFF_11_9_X1 = ADC_RAW_MUX | 0x33,
+  ADC_DIFF_12_9_X1 = ADC_RAW_MUX | 0x34,
+  ADC_DIFF_13_9_X1 = ADC_RAW_MUX | 0x35,
+  ADC_DIFF_14_9_X1 = ADC_RAW_MUX | 0x36,
+  ADC_DIFF_15_9_X1 = ADC_RAW_MUX | 0x37,
+  ADC_DIFF_8_10_X1 = ADC_RAW_MUX | 0x38,
+  ADC_DIFF_9_10_X1 = ADC_RAW_MUX | 0x39,
+  ADC_DIFF_11_10_X1 = ADC_RAW_MUX | 0x3b,
+  ADC_DIFF_12_10_X1 = ADC_RAW_MUX | 0x3c,
+  ADC_DIFF_13_10_X1 = ADC_RAW_MUX | 0x3d,
+#endif  // HAS_ADC_MUX5
+};
+
 IORegister(ADCSRA);
+IORegister(ADCSRB);
 
 typedef BitInRegister<ADCSRARegister, ADSC> AdcConvert;
 typedef BitInRegister<ADCSRARegister, ADEN> AdcEnabled;
+typedef BitInRegister<ADCSRARegister, ADIE> AdcInterrupt;
+typedef BitInRegister<ADCSRARegister, ADATE> AdcAutoTrigger;
+#ifdef HAS_ADC_MUX5
+typedef BitInRegister<ADCSRBRegister, MUX5> AdcMux5;
+#endif  // HAS_ADC_MUX5
 
 class Adc {
  public:
@@ -75,9 +152,48 @@ class Adc {
   }
   
   static inline void StartConversion(uint8_t pin) {
-    ADMUX = admux_value_ | (pin & 0x07);
+    set_channel(pin);
     AdcConvert::set();
   }
+  static inline void set_channel(uint8_t pin) {
+#ifdef HAS_ADC_MUX5
+    uint8_t mux;
+    if (pin & ADC_RAW_MUX) {
+      mux = pin;
+    } else {
+      mux = pin & 0x07;
+      if (pin & 0x08) {
+        mux |= 0x20;
+      }
+    }
+    if (mux & 0x20) {
+      AdcMux5::set();
+    } else {
+      AdcMux5::clear();
+    }
+    ADMUX = admux_value_ | (mux & 0x1f);
+#else
+    if (pin & ADC_RAW_MUX) {
+      ADMUX = admux_value_ | (pin & 0x1f);
+    } else {
+      ADMUX = admux_value_ | (pin & 0x07);
+    }
+#endif  // HAS_ADC_MUX5
+  }
+  static inline void EnableInterrupt() {
+    AdcInterrupt::set();
+  }
+  static inline void DisableInterrupt() {
+    AdcInterrupt::clear();
+  }
+  // Conversions are started by the trigger source instead of by software.
+  static inline void set_trigger(AdcTriggerSource source) {
+    ADCSRB = (ADCSRB & ~0x07) | source;
+    AdcAutoTrigger::set();
+  }
+  static inline void DisableAutoTrigger() {
+    AdcAutoTrigger::clear();
+  }
   static inline void Wait() {
     while (AdcConvert::value());
   }
@@ -93,6 +209,15 @@ class Adc {
   static inline uint8_t ReadOut8() {
     return ADCH;
   }
+  // Differential conversions return a signed value. Only works when the ADC
+  // is right aligned.
+  static inline int16_t ReadOutDifferential() {
+    int16_t value = ReadOut();
+    if (value & 0x200) {
+      value |= 0xfc00;
+    }
+    return value;
+  }
 
  private:
   static uint8_t admux_value_;
@@ -102,15 +227,17 @@ class Adc {
 
 // Class that cycles through all the analog pins and read their value. Compared
 // to Adc::Read(), this class is wait-free as it doesn't block on the
-// ADSC bit value.
-class AdcInputScanner {
+// ADSC bit value. max_inputs is the size of the array of readings - 16 are
+// needed to scan all the inputs of the ATmega640/1280/2560.
+template<uint8_t max_inputs = 8>
+class BasicAdcInputScanner {
  public:
   enum {
     buffer_size = 0,
     data_size = 16,
   };
    
-  AdcInputScanner() { }
+  BasicAdcInputScanner() { }
   
   static void Init() {
     Adc::Init();
@@ -119,7 +246,7 @@ class AdcInputScanner {
   }
   
   static inline void set_num_inputs(uint8_t num_inputs) {
-    num_inputs_ = num_inputs;
+    num_inputs_ = num_inputs > max_inputs ? max_inputs : num_inputs;
   }
   
   static inline int16_t Read(uint8_t pin) {
@@ -154,11 +281,239 @@ class AdcInputScanner {
  private:
   static uint8_t current_pin_;
   static uint8_t num_inputs_;
-  static int16_t state_[8];
+  static int16_t state_[max_inputs];
   
-  DISALLOW_COPY_AND_ASSIGN(AdcInputScanner);
+  DISALLOW_COPY_AND_ASSIGN(BasicAdcInputScanner);
+};
+
+/* static */
+template<uint8_t max_inputs>
+uint8_t BasicAdcInputScanner<max_inputs>::current_pin_;
+
+/* static */
+template<uint8_t max_inputs>
+uint8_t BasicAdcInputScanner<max_inputs>::num_inputs_;
+
+/* static */
+template<uint8_t max_inputs>
+int16_t BasicAdcInputScanner<max_inputs>::state_[max_inputs];
+
+typedef BasicAdcInputScanner<8> AdcInputScanner;
+
+// Per-channel filters for AsyncAdcScanner. A filter receives the 10-bit
+// samples from the interrupt handler, and returns 1 whenever it has a new
+// output value (of "resolution" bits) available.
+
+// One-pole low-pass filter, with a time constant of 2^smoothing samples
+// (smoothing <= 6).
+template<uint8_t smoothing = 2>
+struct OnePoleAdcFilter {
+  enum {
+    resolution = 10
+  };
+  struct State {
+    uint16_t accumulator;
+  };
+  static inline uint8_t Process(State* state, uint16_t sample, uint16_t* out) {
+    state->accumulator += sample - (state->accumulator >> smoothing);
+    *out = state->accumulator >> smoothing;
+    return 1;
+  }
+};
+
+template<bool wide>
+struct AdcAccumulator {
+  typedef uint16_t Type;
+};
+
+template<>
+struct AdcAccumulator<true> {
+  typedef uint32_t Type;
+};
+
+// Oversampling and decimation: 4^extra_bits samples are combined into one
+// output value with 10 + extra_bits bits of resolution (extra_bits <= 4).
+// With order = 1, the samples are simply summed (boxcar filter). With
+// order = 2, a second order CIC filter is used, which has a better rejection
+// of the noise above the output rate. The output can be further smoothed by a
+// one-pole low-pass filter running at the output rate (smoothing <= 16 -
+// resolution).
+template<uint8_t extra_bits = 2, uint8_t order = 1, uint8_t smoothing = 0>
+struct DecimatingAdcFilter {
+  enum {
+    resolution = 10 + extra_bits,
+    decimation = 1 << (2 * extra_bits),
+    // The CIC filter gain is decimation ^ order.
+    shift = (2 * order - 1) * extra_bits
+  };
+  typedef typename AdcAccumulator<
+      (order > 1 || extra_bits > 3)>::Type Accumulator;
+  struct State {
+    Accumulator integrator[order];
+    Accumulator comb[order];
+    uint16_t smoothed;
+    uint8_t count;
+  };
+  static inline uint8_t Process(State* state, uint16_t sample, uint16_t* out) {
+    state->integrator[0] += sample;
+    if (order > 1) {
+      state->integrator[1] += state->integrator[0];
+    }
+    state->count = (state->count + 1) & (decimation - 1);
+    if (state->count) {
+      return 0;
+    }
+    Accumulator y;
+    if (order == 1) {
+      y = state->integrator[0];
+      state->integrator[0] = 0;
+    } else {
+      // Integrators are left running, wrap-around is canceled by the combs.
+      y = state->integrator[order - 1];
+      for (uint8_t i = 0; i < order; ++i) {
+        Accumulator delayed = state->comb[i];
+        state->comb[i] = y;
+        y -= delayed;
+      }
+    }
+    uint16_t value = y >> shift;
+    if (smoothing) {
+      state->smoothed += value - (state->smoothed >> smoothing);
+      value = state->smoothed >> smoothing;
+    }
+    *out = value;
+    return 1;
+  }
+};
+
+// Scanner running entirely from the ADC conversion complete interrupt. The
+// conversions are either free-running, or triggered by a timer for a fixed,
+// jitter-free sample rate. Each channel goes through a filter (see above),
+// whose output is stored so that reading a value does not involve any
+// computation.
+//
+// The interrupt handler must be installed by the application:
+//
+// ADC_CONVERSION_COMPLETE {
+//   Scanner::OnConversionComplete();
+// }
+template<
+    uint8_t num_inputs,
+    uint8_t first_input_index = 0,
+    AdcTriggerSource trigger = ADC_TRIGGER_FREE_RUNNING,
+    typename Filter = OnePoleAdcFilter<2> >
+class AsyncAdcScanner {
+ public:
+  enum {
+    resolution = Filter::resolution
+  };
+
+  AsyncAdcScanner() { }
+
+  static void Init() {
+    Adc::Init();
+    Adc::set_alignment(ADC_RIGHT_ALIGNED);
+    memset((void*)(sample_), 0, sizeof(sample_));
+    memset((void*)(value_), 0, sizeof(value_));
+    memset(state_, 0, sizeof(state_));
+    converting_ = 0;
+    mux_ = 0;
+    Adc::set_channel(first_input_index);
+    Adc::set_trigger(trigger);
+    Adc::EnableInterrupt();
+    if (trigger == ADC_TRIGGER_FREE_RUNNING) {
+      AdcConvert::set();
+    }
+  }
+
+  static void Done() {
+    Adc::DisableInterrupt();
+    Adc::DisableAutoTrigger();
+  }
+
+  // To be called from the ADC interrupt handler.
+  static inline void OnConversionComplete() {
+    uint8_t channel;
+    if (trigger == ADC_TRIGGER_FREE_RUNNING) {
+      // In free-running mode, the next conversion has already started when
+      // the interrupt fires, so a new channel selection only applies to the
+      // conversion after the next one.
+      channel = converting_;
+      converting_ = mux_;
+    } else {
+      channel = mux_;
+    }
+    ++mux_;
+    if (mux_ == num_inputs) {
+      mux_ = 0;
+    }
+    Adc::set_channel(mux_ + first_input_index);
+    if (trigger == ADC_TRIGGER_TIMER0_COMPARE_A) {
+      TIFR0 = _BV(OCF0A);
+    } else if (trigger == ADC_TRIGGER_TIMER1_COMPARE_B) {
+      TIFR1 = _BV(OCF1B);
+    }
+
+    uint16_t sample = Adc::ReadOut();
+    uint16_t value;
+    sample_[channel] = sample;
+    if (Filter::Process(&state_[channel], sample, &value)) {
+      value_[channel] = value;
+    }
+  }
+
+  // Latest filtered value. The value is read twice to detect whether it has
+  // been modified by the interrupt handler in the meantime.
+  static inline uint16_t value(uint8_t index) {
+    uint16_t v;
+    do {
+      v = value_[index];
+    } while (v != value_[index]);
+    return v;
+  }
+
+  // Latest unfiltered value (10 bits).
+  static inline uint16_t sample(uint8_t index) {
+    uint16_t v;
+    do {
+      v = sample_[index];
+    } while (v != sample_[index]);
+    return v;
+  }
+
+ private:
+  static volatile uint16_t sample_[num_inputs];
+  static volatile uint16_t value_[num_inputs];
+  static typename Filter::State state_[num_inputs];
+  static uint8_t converting_;
+  static uint8_t mux_;
+
+  DISALLOW_COPY_AND_ASSIGN(AsyncAdcScanner);
 };
 
+/* static */
+template<uint8_t num_inputs, uint8_t b, AdcTriggerSource c, typename d>
+volatile uint16_t AsyncAdcScanner<num_inputs, b, c, d>::sample_[num_inputs];
+
+/* static */
+template<uint8_t num_inputs, uint8_t b, AdcTriggerSource c, typename d>
+volatile uint16_t AsyncAdcScanner<num_inputs, b, c, d>::value_[num_inputs];
+
+/* static */
+template<uint8_t num_inputs, uint8_t b, AdcTriggerSource c, typename Filter>
+typename Filter::State AsyncAdcScanner<num_inputs, b, c, Filter>::state_[
+    num_inputs];
+
+/* static */
+template<uint8_t a, uint8_t b, AdcTriggerSource c, typename d>
+uint8_t AsyncAdcScanner<a, b, c, d>::converting_;
+
+/* static */
+template<uint8_t a, uint8_t b, AdcTriggerSource c, typename d>
+uint8_t AsyncAdcScanner<a, b, c, d>::mux_;
+
+#define ADC_CONVERSION_COMPLETE ISR(ADC_vect)
+
 template<int pin>
 struct AnalogInput {
   enum {
@@ -15,8 +15,9 @@
 //
 // -----------------------------------------------------------------------------
 //
-// Audio output. Supports PWM (through a PwmOutput object) and DAC (through a
-// Dac object, for example the one defined in mcp492x.h).
+// Audio output. Supports PWM (through a PwmOutput object, see pwm_output.h for
+// outputs with more than 8 bits) and DAC (through a Dac object, for example the
+// one defined in mcp492x.h).
 
 #ifndef AVRLIB_AUDIO_OUTPUT_H_
 #define AVRLIB_AUDIO_OUTPUT_H_
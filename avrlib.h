@@ -79,6 +79,11 @@ struct BitInRegister {
   static void toggle() {
     *Register::ptr() ^= _BV(bit);
   }
+  // Clears a flag which is cleared by writing a 1 to it, with a plain store
+  // rather than a read-modify-write. 0s are written to the other bits.
+  static void clear_flag() {
+    *Register::ptr() = _BV(bit);
+  }
   static uint8_t value() {
     return *Register::ptr() & _BV(bit) ? 1 : 0;
   }
@@ -44,12 +44,25 @@
 // When Q7, is high, ~Q0 to ~Q6 are controlling the second color.
 //
 // By toggling Q7 rapidly, the two colors can be displayed simultaneously.
+//
+// Sync() copies the buffered pixels into the pixels being displayed, as is.
+// Swap() applies a gamma correction to both colors, and hands the result over
+// to the refresh interrupt, which displays it from the beginning of the next
+// refresh frame (64 calls to Write()), so that no frame mixes old and new
+// pixels. Swap() returns 0, without doing anything, while the previous frame
+// has not been picked up.
+//
+// set_direct_pixel() and Sync() disable interrupts while they write into the
+// front buffer, since the refresh interrupt swaps it. Their changes are
+// discarded when a frame queued by Swap() is displayed.
 
 #ifndef AVRLIB_DEVICES_BICOLOR_LED_ARRAY_H_
 #define AVRLIB_DEVICES_BICOLOR_LED_ARRAY_H_
 
+#include <avr/interrupt.h>
 #include <string.h>
 
+#include "avrlib/devices/led_gamma.h"
 #include "avrlib/devices/shift_register.h"
 #include "avrlib/op.h"
 
@@ -66,6 +79,8 @@ class BicolorLedArray {
   
   static inline void Init() {
     Register::Init();
+    front_ = 0;
+    swap_pending_ = 0;
     Clear();
   }
   
@@ -76,7 +91,10 @@ class BicolorLedArray {
   }
 
   static inline void set_direct_pixel(uint8_t index, uint8_t intensity) {
-    pixels_[index] = intensity;
+    uint8_t old_sreg = SREG;
+    cli();
+    pixels_[front_][index] = intensity;
+    SREG = old_sreg;
   }
   
   static inline uint8_t pixel(uint8_t index) {
@@ -100,10 +118,34 @@ class BicolorLedArray {
   }
   
   static inline void Sync() {
-    memcpy(pixels_, buffered_pixels_, size);
+    uint8_t old_sreg = SREG;
+    cli();
+    memcpy(pixels_[front_], buffered_pixels_, size);
+    SREG = old_sreg;
+  }
+
+  static uint8_t Swap() {
+    if (swap_pending_) {
+      return 0;
+    }
+    uint8_t* back = pixels_[front_ ^ 1];
+    for (uint8_t i = 0; i < size; ++i) {
+      uint8_t intensity = buffered_pixels_[i];
+      back[i] = U8ShiftLeft4(LedGamma<4>(U8ShiftRight4(intensity) * 17)) |
+          LedGamma<4>((intensity & 0x0f) * 17);
+    }
+    swap_pending_ = 1;
+    return 1;
   }
+
+  static inline uint8_t swap_pending() { return swap_pending_; }
   
   static inline void ShiftOutPixels() {
+    if (!(refresh_cycle_ & 0x3f) && swap_pending_) {
+      front_ ^= 1;
+      swap_pending_ = 0;
+    }
+    const uint8_t* pixels = pixels_[front_];
     uint8_t threshold = refresh_cycle_ & 0x0f;
     uint8_t color = refresh_cycle_ & 0x20 ? 1 : 0;
     
@@ -114,9 +156,9 @@ class BicolorLedArray {
       byte <<= 1;
       uint8_t intensity;
       if (color) {
-        intensity = U8ShiftRight4(~pixels_[i]);
+        intensity = U8ShiftRight4(~pixels[i]);
       } else {
-        intensity = pixels_[i] & 0x0f;
+        intensity = pixels[i] & 0x0f;
       }
       if (intensity > threshold || intensity == 0xf) {
         byte |= 1;
@@ -143,14 +185,22 @@ class BicolorLedArray {
   typedef ShiftRegisterOutput<Latch, Clock, Data, 8, MSB_FIRST> Register;
 
   static uint8_t buffered_pixels_[size];
-  static uint8_t pixels_[size];
+  static uint8_t pixels_[2][size];
+  static uint8_t front_;
+  static volatile uint8_t swap_pending_;
   static uint8_t refresh_cycle_;
 
   DISALLOW_COPY_AND_ASSIGN(BicolorLedArray);
 };
 
 template<typename Latch, typename Clock, typename Data, uint8_t num_regs>
-uint8_t BicolorLedArray<Latch, Clock, Data, num_regs>::pixels_[size];
+uint8_t BicolorLedArray<Latch, Clock, Data, num_regs>::pixels_[2][size];
+
+template<typename Latch, typename Clock, typename Data, uint8_t num_regs>
+uint8_t BicolorLedArray<Latch, Clock, Data, num_regs>::front_;
+
+template<typename Latch, typename Clock, typename Data, uint8_t num_regs>
+volatile uint8_t BicolorLedArray<Latch, Clock, Data, num_regs>::swap_pending_;
 
 template<typename Latch, typename Clock, typename Data, uint8_t num_regs>
 uint8_t BicolorLedArray<Latch, Clock, Data, num_regs>::buffered_pixels_[size];
@@ -22,6 +22,20 @@
 // containing the requested text page. The 2 buffer are compared in a background
 // process and differences are sent to the LCD display. This also manages a
 // software blinking cursor.
+//
+// The rows written to with Print() or line_buffer() are flagged as dirty, and
+// are scanned first, in full runs as long as there is room in the LCD output
+// buffer. When no row is dirty, the background scan checks one character per
+// call to Tick(), so that writes through a line_buffer() pointer kept across
+// frames are still caught.
+//
+// The 8 custom characters of the display can be managed as a cache of glyphs:
+// glyph(id, bitmap) returns the character code to use for a glyph, and
+// queues its upload if it is not in one of the slots already. The least
+// recently used slot not found on the page is replaced. The uploads are sent
+// by Tick() before any other character, so a glyph is always defined before
+// being drawn. The codes returned are 8 to 15 (mapped by the controller to
+// the same 8 slots as 0 to 7), so that they can be used in strings.
 
 #ifndef AVRLIB_DEVICES_BUFFERED_DISPLAY_H_
 #define AVRLIB_DEVICES_BUFFERED_DISPLAY_H_
@@ -39,6 +53,10 @@ static const uint8_t kLcdNoCursor = 0xff;
 static const uint8_t kLcdCursor = 0xff;
 static const uint8_t kLcdEditCursor = '_';
 
+static const uint8_t kNumGlyphSlots = 8;
+static const uint8_t kFirstGlyphCode = 8;
+static const uint8_t kNoGlyph = 0xff;
+
 template<typename Lcd>
 class BufferedDisplay {
  public:
@@ -59,9 +77,17 @@ class BufferedDisplay {
     scan_position_last_write_ = 255;
     cursor_position_ = 255;
     blink_ = 0;
+    previous_blink_counter_ = 0;
+    dirty_rows_ = (1 << height) - 1;
+    in_dirty_row_ = 0;
+    memset(glyph_id_, kNoGlyph, sizeof(glyph_id_));
+    memset(glyph_last_use_, 0, sizeof(glyph_last_use_));
+    glyph_clock_ = 0;
+    pending_glyphs_ = 0;
   }
   
   static char* line_buffer(uint8_t line) {
+    dirty_rows_ |= 1 << line;
     return static_cast<char*>(
         static_cast<void*>(local_ + U8U8Mul(line, width)));
   }
@@ -78,11 +104,16 @@ class BufferedDisplay {
   
   static void Clear() {
     memset(local_, ' ', lcd_buffer_size);
+    dirty_rows_ = (1 << height) - 1;
   }
 
   // Use kLcdNoCursor (255) or any other value outside of the screen to hide.
   static inline void set_cursor_position(uint8_t cursor) {
-    cursor_position_ = cursor;
+    if (cursor != cursor_position_) {
+      MarkCursorDirty();
+      cursor_position_ = cursor;
+      MarkCursorDirty();
+    }
   }
 
   static inline void set_cursor_character(uint8_t character) {
@@ -95,6 +126,7 @@ class BufferedDisplay {
 
   static inline void set_status(uint8_t status) {
     status_ = status + 1;
+    dirty_rows_ |= 1;
     Lcd::ResetStatusCounter();
     previous_status_counter_ = 0;
   }
@@ -104,33 +136,139 @@ class BufferedDisplay {
       return;
     }
     status_ = status + 1;
+    if (in_dirty_row_) {
+      // Resume the interrupted row later.
+      dirty_rows_ |= 1 << scan_row_;
+      in_dirty_row_ = 0;
+    }
     scan_position_ = 0;
     scan_row_ = 0;
     scan_column_ = 0;
     Lcd::MoveCursor(scan_row_, scan_column_);
     Lcd::WriteData(status_ - 1);
     remote_[scan_position_] = status_ - 1;
+    scan_position_last_write_ = 0;
+    dirty_rows_ |= 1;
   }
   
   static void BlinkCursor() {
     ++blink_;
   }
 
+  // id identifies the glyph (0 to 254); bitmap is its 8 rows, in program
+  // memory.
+  static uint8_t glyph(uint8_t id, const uint8_t* bitmap) {
+    ++glyph_clock_;
+    for (uint8_t i = 0; i < kNumGlyphSlots; ++i) {
+      if (glyph_id_[i] == id) {
+        glyph_last_use_[i] = glyph_clock_;
+        return kFirstGlyphCode + i;
+      }
+    }
+
+    // Miss. Do not replace a glyph still used on the page, unless all of them
+    // are.
+    uint8_t used = 0;
+    for (uint8_t i = 0; i < lcd_buffer_size; ++i) {
+      if ((local_[i] & ~(kFirstGlyphCode | (kNumGlyphSlots - 1))) == 0) {
+        used |= 1 << (local_[i] & (kNumGlyphSlots - 1));
+      }
+    }
+    uint8_t slot = 0;
+    uint8_t found = 0;
+    uint16_t oldest = 0;
+    for (uint8_t pass = 0; pass < 2 && !found; ++pass) {
+      for (uint8_t i = 0; i < kNumGlyphSlots; ++i) {
+        if (pass == 0 && (used & (1 << i))) {
+          continue;
+        }
+        uint16_t age = glyph_id_[i] == kNoGlyph ?
+            0xffff : glyph_clock_ - glyph_last_use_[i];
+        if (!found || age > oldest) {
+          oldest = age;
+          slot = i;
+          found = 1;
+        }
+      }
+    }
+    glyph_id_[slot] = id;
+    glyph_bitmap_[slot] = bitmap;
+    glyph_last_use_[slot] = glyph_clock_;
+    pending_glyphs_ |= 1 << slot;
+    return kFirstGlyphCode + slot;
+  }
+
   static void Tick() {
-    // The following code is likely to write 4 bytes at most. If there are less
-    // than 4 bytes available for write in the output buffer, there's no reason
-    // to take the risk to continue.
+    // Each character update is likely to write 4 bytes at most. If there are
+    // less than 4 bytes available for write in the output buffer, there's no
+    // reason to take the risk to continue.
     if (Lcd::writable() < 4) {
       return;
     }
     // It is now safe to assume that all writes of 4 bytes to the display buffer
-    // will not block.
+    // will not block - and this is checked again before each character.
     
     if (previous_status_counter_ > Lcd::status_counter()) {
       status_ = 0;
+      dirty_rows_ |= 1;
     }
     previous_status_counter_ = Lcd::status_counter();
 
+    if ((blink_ ^ previous_blink_counter_) & 128) {
+      MarkCursorDirty();
+    }
+    previous_blink_counter_ = blink_;
+
+    // Glyphs are uploaded before anything else is drawn.
+    while (pending_glyphs_) {
+      uint8_t slot = 0;
+      while (!(pending_glyphs_ & (1 << slot))) {
+        ++slot;
+      }
+      if (!Lcd::WriteCustomCharRes(slot, glyph_bitmap_[slot])) {
+        return;
+      }
+      pending_glyphs_ &= ~(1 << slot);
+      // The LCD is now in CGRAM mode, force a cursor move on the next write.
+      scan_position_last_write_ = 255;
+    }
+    if (Lcd::writable() < 4) {
+      return;
+    }
+
+    while (1) {
+      if (!in_dirty_row_ && dirty_rows_) {
+        // Jump to the next dirty row.
+        uint8_t row = scan_row_;
+        while (!(dirty_rows_ & (1 << row))) {
+          ++row;
+          if (row == height) {
+            row = 0;
+          }
+        }
+        // The flag is cleared now, so that a write to the row during the scan
+        // triggers another one.
+        dirty_rows_ &= ~(1 << row);
+        in_dirty_row_ = 1;
+        scan_row_ = row;
+        scan_column_ = 0;
+        scan_position_ = U8U8Mul(row, width);
+      }
+      UpdateCharacter();
+      if (!in_dirty_row_ && !dirty_rows_) {
+        // Background scan: one character per call.
+        break;
+      }
+      if (Lcd::writable() < 4) {
+        break;
+      }
+    }
+  }
+
+ private:
+  // Sends the character at the scan position if it differs from what the
+  // display shows, and moves to the next position.
+  static void UpdateCharacter() {
     uint8_t character = 0;
     // Determine which character to show at the current position.
     // If the scan position is the cursor and it is shown (blinking), draw the
@@ -171,6 +309,7 @@ class BufferedDisplay {
     ++scan_position_;
     if (scan_column_ == width) {
       scan_column_ = 0;
+      in_dirty_row_ = 0;
       ++scan_row_;
       if (scan_row_ == height) {
         scan_row_ = 0;
@@ -179,7 +318,12 @@ class BufferedDisplay {
     }
   }
 
- private:
+  static void MarkCursorDirty() {
+    if (cursor_position_ < lcd_buffer_size) {
+      dirty_rows_ |= 1 << (cursor_position_ / width);
+    }
+  }
+
   // Character pages storing what the display currently shows (remote), and
   // what it ought to show (local).
   static uint8_t local_[width * height + 1];
@@ -197,6 +341,17 @@ class BufferedDisplay {
   static uint8_t cursor_character_;
   static uint8_t status_;
 
+  // Bit i is set when row i has to be scanned.
+  static uint8_t dirty_rows_;
+  static uint8_t in_dirty_row_;
+
+  // Custom character slots.
+  static uint8_t glyph_id_[kNumGlyphSlots];
+  static const uint8_t* glyph_bitmap_[kNumGlyphSlots];
+  static uint16_t glyph_last_use_[kNumGlyphSlots];
+  static uint16_t glyph_clock_;
+  static uint8_t pending_glyphs_;
+
   DISALLOW_COPY_AND_ASSIGN(BufferedDisplay);
 };
 
@@ -232,6 +387,10 @@ uint8_t BufferedDisplay<Lcd>::blink_;
 template<typename Lcd>
 uint8_t BufferedDisplay<Lcd>::previous_status_counter_;
 
+/* static */
+template<typename Lcd>
+uint8_t BufferedDisplay<Lcd>::previous_blink_counter_;
+
 /* static */
 template<typename Lcd>
 uint8_t BufferedDisplay<Lcd>::cursor_position_;
@@ -244,6 +403,34 @@ uint8_t BufferedDisplay<Lcd>::cursor_character_ = kLcdCursor;
 template<typename Lcd>
 uint8_t BufferedDisplay<Lcd>::status_;
 
+/* static */
+template<typename Lcd>
+uint8_t BufferedDisplay<Lcd>::dirty_rows_;
+
+/* static */
+template<typename Lcd>
+uint8_t BufferedDisplay<Lcd>::in_dirty_row_;
+
+/* static */
+template<typename Lcd>
+uint8_t BufferedDisplay<Lcd>::glyph_id_[kNumGlyphSlots];
+
+/* static */
+template<typename Lcd>
+const uint8_t* BufferedDisplay<Lcd>::glyph_bitmap_[kNumGlyphSlots];
+
+/* static */
+template<typename Lcd>
+uint16_t BufferedDisplay<Lcd>::glyph_last_use_[kNumGlyphSlots];
+
+/* static */
+template<typename Lcd>
+uint16_t BufferedDisplay<Lcd>::glyph_clock_;
+
+/* static */
+template<typename Lcd>
+uint8_t BufferedDisplay<Lcd>::pending_glyphs_;
+
 }  // namespace avrlib
 
 #endif   // AVRLIB_DEVICES_BUFFERED_DISPLAY_H_
@@ -21,6 +21,15 @@
 // multiple chips. For example, if four 16k chips (AT24C128) are connected on the
 // bus, R/W to addresses 0x0000 - 0x4000 will be addressed to chip 1, 
 // R/W to addresses 0x4000 - 0x8000 will be addressed to chip 2, etc.
+//
+// Instead of waiting for a fixed 5ms after each block write, the end of the
+// internal write cycle is detected by acknowledge polling: the chip does not
+// acknowledge its address until it is ready. The polling is done right before
+// the next access, so the write cycle overlaps with whatever the caller does
+// in the meantime.
+//
+// Large writes can also be performed in the background with WriteAsync: the
+// blocks are sent, and the chip polled, from the I2C interrupt handler.
 
 #ifndef AVRLIB_DEVICES_EXTERNAL_EEPROM_H_
 #define AVRLIB_DEVICES_EXTERNAL_EEPROM_H_
@@ -30,6 +39,12 @@
 
 namespace avrlib {
 
+enum ExternalEepromAsyncState {
+  EXTERNAL_EEPROM_IDLE,
+  EXTERNAL_EEPROM_POLLING,
+  EXTERNAL_EEPROM_WRITING
+};
+
 template<uint16_t eeprom_size = 8192 /* bytes */,
          typename Bus = I2cMaster<8, 64>,
          uint8_t base_address = 0,
@@ -37,6 +52,12 @@ template<uint16_t eeprom_size = 8192 /* bytes */,
          uint8_t block_size = 32>
 class ExternalEeprom {
  public:
+  enum {
+    // At 100kHz, a poll takes about 100us, so this gives the chip 25ms to
+    // complete its write cycle (5ms is the typical worst case).
+    max_polls = 255
+  };
+
   ExternalEeprom() { }
 
   static void Init() {
@@ -104,7 +125,6 @@ class ExternalEeprom {
       if (WriteWithinBlock(address, data, writable) != writable) {
         break;
       }
-      ConstantDelay(5);
       written += writable;
       address += writable;
       data += writable;
@@ -158,16 +178,144 @@ class ExternalEeprom {
   
   static inline uint8_t Write(uint16_t address, uint8_t byte) {
     uint8_t data = byte;
-    return Write(&data, 1);
+    return Write(address, &data, 1);
+  }
+
+  // Starts writing a large buffer in the background. The buffer must not be
+  // modified, and the bus must not be used, until writing() returns 0.
+  // Returns 0 if the write could not be started.
+  static uint8_t WriteAsync(
+      uint16_t address,
+      const uint8_t* data,
+      uint16_t size) {
+    // The address and a full block are queued at once in the output buffer.
+    STATIC_ASSERT(block_size + 2 < Bus::Output::size);
+    if (!size) {
+      return 1;
+    }
+    Flush();
+    async_address_ = address;
+    async_data_ = data;
+    async_size_ = size;
+    async_error_ = I2C_ERROR_NONE;
+    async_polls_ = max_polls;
+    async_state_ = EXTERNAL_EEPROM_POLLING;
+    Bus::Wait();
+    Bus::set_completion_handler(&AsyncHandler);
+    if (!Bus::Ping(device_address(address))) {
+      Bus::set_completion_handler(NULL);
+      async_state_ = EXTERNAL_EEPROM_IDLE;
+      return 0;
+    }
+    return 1;
+  }
+
+  static inline uint8_t writing() {
+    return async_state_ != EXTERNAL_EEPROM_IDLE;
+  }
+
+  // Number of bytes from the last WriteAsync call not yet written.
+  static inline uint16_t pending() {
+    return async_size_;
+  }
+
+  static inline uint8_t async_error() {
+    return async_error_;
+  }
+
+  // Waits for the completion of a background write.
+  static inline void Flush() {
+    while (writing()) { }
+  }
+
+  // Waits until the chip has completed its internal write cycle.
+  static uint8_t WaitWriteCycle() {
+    uint8_t polls = max_polls;
+    uint8_t address = (base_address + bank_) | 0x50;
+    while (polls--) {
+      Bus::Wait();
+      if (Bus::Ping(address) && Bus::Wait() == I2C_ERROR_NONE) {
+        return 1;
+      }
+    }
+    return 0;
   }
  
  private:
+  static inline uint8_t device_address(uint16_t address) {
+    uint8_t bank = auto_banking ? address / eeprom_size : bank_;
+    return (base_address + bank) | 0x50;
+  }
+
+  // Called from the I2C interrupt handler at the end of each transaction of a
+  // background write. Alternates between polling the chip until it is ready,
+  // and sending it the next block.
+  static void AsyncHandler() {
+    uint8_t error = Bus::Wait();
+    if (async_state_ == EXTERNAL_EEPROM_POLLING) {
+      if (error != I2C_ERROR_NONE) {
+        if (--async_polls_) {
+          Bus::Ping(device_address(async_address_));
+        } else {
+          EndAsync(error);
+        }
+        return;
+      }
+      uint16_t address = async_address_;
+      uint8_t writable = block_size - (address % block_size);
+      if (writable > async_size_) {
+        writable = async_size_;
+      }
+      if (auto_banking) {
+        bank_ = (address / eeprom_size);
+        address %= eeprom_size;
+      }
+      Bus::Overwrite(address >> 8);
+      Bus::Overwrite(address & 0xff);
+      const uint8_t* data = async_data_;
+      for (uint8_t i = 0; i < writable; ++i) {
+        Bus::Overwrite(*data++);
+      }
+      async_block_size_ = writable;
+      async_state_ = EXTERNAL_EEPROM_WRITING;
+      Bus::Send((base_address + bank_) | 0x50);
+    } else if (async_state_ == EXTERNAL_EEPROM_WRITING) {
+      if (error != I2C_ERROR_NONE) {
+        Bus::FlushOutputBuffer();
+        EndAsync(error);
+        return;
+      }
+      async_address_ += async_block_size_;
+      async_data_ += async_block_size_;
+      async_size_ -= async_block_size_;
+      if (!async_size_) {
+        EndAsync(I2C_ERROR_NONE);
+        return;
+      }
+      async_polls_ = max_polls;
+      async_state_ = EXTERNAL_EEPROM_POLLING;
+      Bus::Ping(device_address(async_address_));
+    }
+  }
+
+  static inline void EndAsync(uint8_t error) {
+    async_error_ = error;
+    Bus::set_completion_handler(NULL);
+    async_state_ = EXTERNAL_EEPROM_IDLE;
+  }
+
   static uint8_t Write(const uint8_t* header, uint8_t header_size, 
                        const uint8_t* payload, uint8_t payload_size) {
     uint8_t size = header_size + payload_size;
     if (size >= Bus::Output::capacity()) {
       return 0;  // Hopeless, it won't fit in one write.
     }
+    // Make sure that no background write is in progress, and that the chip
+    // is done with the previous write.
+    Flush();
+    if (!WaitWriteCycle()) {
+      return 0;
+    }
     // Wait until the buffer is flushed, and write to the buffer.
     while (Bus::writable() < size) { }
     for (uint8_t i = 0; i < header_size; ++i) {
@@ -193,6 +341,14 @@ class ExternalEeprom {
 
   static uint8_t bank_;
 
+  static volatile uint8_t async_state_;
+  static volatile uint16_t async_size_;
+  static uint16_t async_address_;
+  static const uint8_t* async_data_;
+  static uint8_t async_block_size_;
+  static uint8_t async_polls_;
+  static volatile uint8_t async_error_;
+
   DISALLOW_COPY_AND_ASSIGN(ExternalEeprom);
 };
 
@@ -202,6 +358,48 @@ template<uint16_t eeprom_size, typename Bus, uint8_t base_address,
 uint8_t ExternalEeprom<eeprom_size, Bus, base_address,
                        auto_banking, block_size>::bank_ = 0;
 
+/* static */
+template<uint16_t eeprom_size, typename Bus, uint8_t base_address,
+         bool auto_banking, uint8_t block_size>
+volatile uint8_t ExternalEeprom<eeprom_size, Bus, base_address,
+                       auto_banking, block_size>::async_state_ = EXTERNAL_EEPROM_IDLE;
+
+/* static */
+template<uint16_t eeprom_size, typename Bus, uint8_t base_address,
+         bool auto_banking, uint8_t block_size>
+volatile uint16_t ExternalEeprom<eeprom_size, Bus, base_address,
+                       auto_banking, block_size>::async_size_ = 0;
+
+/* static */
+template<uint16_t eeprom_size, typename Bus, uint8_t base_address,
+         bool auto_banking, uint8_t block_size>
+uint16_t ExternalEeprom<eeprom_size, Bus, base_address,
+                       auto_banking, block_size>::async_address_;
+
+/* static */
+template<uint16_t eeprom_size, typename Bus, uint8_t base_address,
+         bool auto_banking, uint8_t block_size>
+const uint8_t* ExternalEeprom<eeprom_size, Bus, base_address,
+                       auto_banking, block_size>::async_data_;
+
+/* static */
+template<uint16_t eeprom_size, typename Bus, uint8_t base_address,
+         bool auto_banking, uint8_t block_size>
+uint8_t ExternalEeprom<eeprom_size, Bus, base_address,
+                       auto_banking, block_size>::async_block_size_;
+
+/* static */
+template<uint16_t eeprom_size, typename Bus, uint8_t base_address,
+         bool auto_banking, uint8_t block_size>
+uint8_t ExternalEeprom<eeprom_size, Bus, base_address,
+                       auto_banking, block_size>::async_polls_;
+
+/* static */
+template<uint16_t eeprom_size, typename Bus, uint8_t base_address,
+         bool auto_banking, uint8_t block_size>
+volatile uint8_t ExternalEeprom<eeprom_size, Bus, base_address,
+                       auto_banking, block_size>::async_error_ = I2C_ERROR_NONE;
+
 }  // namespace avrlib
 
 #endif   // AVRLIB_DEVICES_EXTERNAL_EEPROM_H_
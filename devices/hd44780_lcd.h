@@ -16,11 +16,24 @@
 // -----------------------------------------------------------------------------
 //
 // Driver for a HD44780 LCD display.
+//
+// The data bus is either 4-bit (ParallelPort is a half port, for example
+// ParallelPort<PortB, PARALLEL_NIBBLE_LOW>) or 8-bit (a full port, with
+// LCD_BUS_8_BITS). Characters and commands are queued in a buffer, and sent
+// from Tick(), called from a timer interrupt.
+//
+// Without a R/W pin (the R/W line of the display tied to ground), Tick()
+// raises the enable line on one call and lowers it on the next, and the tick
+// rate must be slow enough for the controller to complete each write: a
+// character takes 4 ticks on a 4-bit bus, 2 on a 8-bit bus. When a RwPin is
+// given, Tick() polls the busy flag of the controller and, if it is ready,
+// sends a whole character at once.
 
 #ifndef AVRLIB_DEVICES_HD44780_LCD_H_
 #define AVRLIB_DEVICES_HD44780_LCD_H_
 
 #include "avrlib/base.h"
+#include "avrlib/gpio.h"
 #include "avrlib/log2.h"
 #include "avrlib/software_serial.h"
 #include "avrlib/time.h"
@@ -62,24 +75,42 @@ enum LCD_FLAGS {
 
   LCD_LARGE_FONT = 0x04,
   LCD_SMALL_FONT = 0x00,
+
+  LCD_BUSY_FLAG = 0x80,
+};
+
+enum LcdBusWidth {
+  LCD_BUS_4_BITS,
+  LCD_BUS_8_BITS
 };
 
 template<typename RsPin,
          typename EnablePin,
          typename ParallelPort,
          uint8_t width = 16,
-         uint8_t height = 2>
+         uint8_t height = 2,
+         LcdBusWidth bus_width = LCD_BUS_4_BITS,
+         typename RwPin = DummyGpio>
 class Hd44780Lcd {
  public:
   enum {
-    buffer_size = 64,
-    data_size = 8,
+    // In 8-bit mode, each entry of the buffer is a whole byte (with the RS
+    // flag in bit 8) instead of a nibble.
+    buffer_size = bus_width == LCD_BUS_8_BITS ? 32 : 64,
+    data_size = bus_width == LCD_BUS_8_BITS ? 16 : 8,
   };
   enum {
     lcd_width = width,
     lcd_height = height,
   };
-  typedef Hd44780Lcd<RsPin, EnablePin, ParallelPort, width, height> Me;
+  enum {
+    eight_bits = bus_width == LCD_BUS_8_BITS,
+    has_busy_flag = !SameType<RwPin, DummyGpio>::value,
+    data_flag = bus_width == LCD_BUS_8_BITS ? 0x100 : LCD_DATA,
+    entries_per_byte = bus_width == LCD_BUS_8_BITS ? 1 : 2
+  };
+  typedef Hd44780Lcd<RsPin, EnablePin, ParallelPort, width, height,
+                     bus_width, RwPin> Me;
   typedef typename DataTypeForSize<data_size>::Type Value;
   typedef RingBuffer<Me> OutputBuffer;
 
@@ -89,24 +120,34 @@ class Hd44780Lcd {
     RsPin::set_mode(DIGITAL_OUTPUT);
     EnablePin::set_mode(DIGITAL_OUTPUT);
     ParallelPort::set_mode(DIGITAL_OUTPUT);
+    RwPin::set_mode(DIGITAL_OUTPUT);
 
     RsPin::Low();
     EnablePin::Low();
+    RwPin::Low();
 
     ConstantDelay(100);  // Wait for warm up
 
-    // Set to 4 bit operation.
-    for (uint8_t i = 0; i < 3; ++i) {
-      SlowWrite((LCD_FUNCTION_SET | LCD_8_BITS) >> 4);
-      ConstantDelay(2);
+    uint8_t bus = eight_bits ? LCD_8_BITS : LCD_4_BITS;
+    if (eight_bits) {
+      for (uint8_t i = 0; i < 3; ++i) {
+        SlowWrite(LCD_FUNCTION_SET | LCD_8_BITS);
+        ConstantDelay(2);
+      }
+    } else {
+      // Set to 4 bit operation.
+      for (uint8_t i = 0; i < 3; ++i) {
+        SlowWrite((LCD_FUNCTION_SET | LCD_8_BITS) >> 4);
+        ConstantDelay(2);
+      }
+      SlowWrite((LCD_FUNCTION_SET | LCD_4_BITS) >> 4);
     }
-    SlowWrite((LCD_FUNCTION_SET | LCD_4_BITS) >> 4);
 
     // Set number of lines and bus size.
     if (height == 2) {
-      SlowCommand(LCD_FUNCTION_SET | LCD_4_BITS | LCD_2_LINE | LCD_SMALL_FONT);
+      SlowCommand(LCD_FUNCTION_SET | bus | LCD_2_LINE | LCD_SMALL_FONT);
     } else {
-      SlowCommand(LCD_FUNCTION_SET | LCD_4_BITS | LCD_SMALL_FONT);
+      SlowCommand(LCD_FUNCTION_SET | bus | LCD_SMALL_FONT);
     }
     SlowCommand(LCD_DISPLAY_STATUS | LCD_DISPLAY_ON | LCD_CURSOR_OFF | LCD_BLINKING_OFF);
     SlowCommand(LCD_ENTRY_MODE | LCD_CURSOR_INCREMENT | LCD_NO_SHIFT);
@@ -117,6 +158,21 @@ class Hd44780Lcd {
 
   static inline void Tick() {
     ++status_counter_;
+    if (has_busy_flag) {
+      // Send a whole byte as soon as the controller is ready for it. E is
+      // kept low for a pulse width before each nibble, after the busy flag
+      // read and between the two nibbles, to respect the 1000ns enable cycle
+      // time.
+      if (OutputBuffer::readable() && !controller_busy()) {
+        for (uint8_t i = 0; i < entries_per_byte; ++i) {
+          Pulse();
+          StartWrite(OutputBuffer::ImmediateRead());
+          Pulse();
+          EndWrite();
+        }
+      }
+      return;
+    }
     if (transmitting_) {
       EndWrite();
       transmitting_ = 0;
@@ -129,21 +185,33 @@ class Hd44780Lcd {
   }
   
   static uint8_t WriteData(uint8_t c) {
-    if (OutputBuffer::writable() < 2) {
+    if (OutputBuffer::writable() < entries_per_byte) {
       return 0;
     }
-    OutputBuffer::Overwrite2(LCD_DATA | (c >> 4), LCD_DATA | (c & 0xf));
+    if (eight_bits) {
+      OutputBuffer::Overwrite(data_flag | c);
+    } else {
+      OutputBuffer::Overwrite2(LCD_DATA | (c >> 4), LCD_DATA | (c & 0xf));
+    }
+    return 1;
   }
 
   static uint8_t WriteCommand(uint8_t c) {
-    if (OutputBuffer::writable() < 2) {
+    if (OutputBuffer::writable() < entries_per_byte) {
       return 0;
     }
-    OutputBuffer::Overwrite2(LCD_COMMAND | (c >> 4), LCD_COMMAND | (c & 0x0f));
+    if (eight_bits) {
+      OutputBuffer::Overwrite(LCD_COMMAND | c);
+    } else {
+      OutputBuffer::Overwrite2(
+          LCD_COMMAND | (c >> 4),
+          LCD_COMMAND | (c & 0x0f));
+    }
+    return 1;
   }
   
   static inline uint8_t Write(uint8_t character) {
-    WriteData(character);
+    return WriteData(character);
   }
   
   static inline uint8_t Write(const char* s) {
@@ -151,6 +219,7 @@ class Hd44780Lcd {
       WriteData(*s);
       ++s;
     }
+    return 1;
   }
 
   static inline void MoveCursor(uint8_t row, uint8_t col) {
@@ -177,6 +246,33 @@ class Hd44780Lcd {
     }
   }
   
+  // Uploads a single custom character through the output buffer, instead of
+  // blocking like SetCustomCharMap: the upload takes place in the order it has
+  // been queued with the other writes. Returns 0 if there is not enough room
+  // in the buffer. The DDRAM address is lost, so the cursor must be moved
+  // before writing characters again.
+  static uint8_t WriteCustomChar(uint8_t character, const uint8_t* data) {
+    if (OutputBuffer::writable() < 9 * entries_per_byte) {
+      return 0;
+    }
+    WriteCommand(LCD_SET_CGRAM_ADDRESS | (character << 3));
+    for (uint8_t i = 0; i < 8; ++i) {
+      WriteData(*data++);
+    }
+    return 1;
+  }
+
+  static uint8_t WriteCustomCharRes(uint8_t character, const uint8_t* data) {
+    if (OutputBuffer::writable() < 9 * entries_per_byte) {
+      return 0;
+    }
+    WriteCommand(LCD_SET_CGRAM_ADDRESS | (character << 3));
+    for (uint8_t i = 0; i < 8; ++i) {
+      WriteData(SimpleResourcesManager::Lookup<uint8_t, uint8_t>(data, i));
+    }
+    return 1;
+  }
+  
   static inline void Flush() {
     while (OutputBuffer::readable() || busy()) {
       Tick();
@@ -192,11 +288,12 @@ class Hd44780Lcd {
   static inline void ResetStatusCounter() { status_counter_ = 0; }
 
  private:
-  static inline void StartWrite(uint8_t nibble) {
-    if (nibble & LCD_DATA) {
+  // A nibble or a byte, depending on the bus width, with the RS flag.
+  static inline void StartWrite(Value value) {
+    if (value & data_flag) {
       RsPin::High();
     }
-    ParallelPort::Write(nibble & 0x0f);
+    ParallelPort::Write(value & (eight_bits ? 0xff : 0x0f));
     EnablePin::High();
   }
 
@@ -205,21 +302,56 @@ class Hd44780Lcd {
     RsPin::Low();
   }
 
-  static void SlowWrite(uint8_t nibble) {
-    StartWrite(nibble);
+  // Enable pulse width (450ns min).
+  static inline void Pulse() {
+    _delay_us(0.5);
+  }
+
+  // Reads the busy flag of the controller. Only available with a RwPin.
+  static uint8_t controller_busy() {
+    ParallelPort::set_mode(DIGITAL_INPUT);
+    RwPin::High();
+    EnablePin::High();
+    Pulse();
+    uint8_t status = ParallelPort::Read();
+    EnablePin::Low();
+    if (!eight_bits) {
+      // The busy flag is the MSB of the first nibble. The second nibble still
+      // has to be clocked out.
+      status <<= 4;
+      Pulse();
+      EnablePin::High();
+      Pulse();
+      EnablePin::Low();
+    }
+    RwPin::Low();
+    ParallelPort::set_mode(DIGITAL_OUTPUT);
+    return status & LCD_BUSY_FLAG;
+  }
+
+  static void SlowWrite(Value value) {
+    StartWrite(value);
     ConstantDelay(1);
     EndWrite();
     ConstantDelay(3);
   }
   
   static void SlowCommand(uint8_t value) {
-    SlowWrite(LCD_COMMAND | (value >> 4));
-    SlowWrite(LCD_COMMAND | (value & 0x0f));
+    if (eight_bits) {
+      SlowWrite(LCD_COMMAND | value);
+    } else {
+      SlowWrite(LCD_COMMAND | (value >> 4));
+      SlowWrite(LCD_COMMAND | (value & 0x0f));
+    }
   }
   
   static void SlowData(uint8_t value) {
-    SlowWrite(LCD_DATA | (value >> 4));
-    SlowWrite(LCD_DATA | (value & 0x0f));
+    if (eight_bits) {
+      SlowWrite(data_flag | value);
+    } else {
+      SlowWrite(LCD_DATA | (value >> 4));
+      SlowWrite(LCD_DATA | (value & 0x0f));
+    }
   }
 
   static volatile uint8_t transmitting_;
@@ -230,15 +362,15 @@ class Hd44780Lcd {
 
 /* static */
 template<typename RsPin, typename EnablePin, typename ParallelPort,
-         uint8_t width, uint8_t height>
-volatile uint8_t Hd44780Lcd<RsPin, EnablePin, ParallelPort, width,
-                            height>::transmitting_;
+         uint8_t width, uint8_t height, LcdBusWidth bus_width, typename RwPin>
+volatile uint8_t Hd44780Lcd<RsPin, EnablePin, ParallelPort, width, height,
+                            bus_width, RwPin>::transmitting_;
 
 /* static */
 template<typename RsPin, typename EnablePin, typename ParallelPort,
-         uint8_t width, uint8_t height>
-volatile uint8_t Hd44780Lcd<RsPin, EnablePin, ParallelPort, width,
-                            height>::status_counter_;
+         uint8_t width, uint8_t height, LcdBusWidth bus_width, typename RwPin>
+volatile uint8_t Hd44780Lcd<RsPin, EnablePin, ParallelPort, width, height,
+                            bus_width, RwPin>::status_counter_;
 
 }  // namespace avrlib
 
@@ -21,39 +21,97 @@
 #ifndef AVRLIB_DEVICES_LED_ARRAY_H_
 #define AVRLIB_DEVICES_LED_ARRAY_H_
 
+#include <avr/interrupt.h>
 #include <string.h>
 
+#include "avrlib/devices/led_gamma.h"
 #include "avrlib/devices/shift_register.h"
 #include "avrlib/op.h"
 
 namespace avrlib {
 
-template<typename Latch, typename Clock, typename Data, uint8_t num_regs = 1, DataOrder order = LSB_FIRST>
+// The brightness is controlled by binary code modulation: the pixels are
+// stored as bit_depth bit-planes, one bit per LED, which are updated as soon
+// as a pixel changes. Plane b is displayed for 2^b refresh ticks, so each
+// refresh only shifts out a precomputed plane, whatever the number of pixels,
+// and a full frame lasts 2^bit_depth - 1 ticks.
+//
+// Write() is to be called at a fixed rate, from a timer interrupt. It only
+// touches the shift registers when a new plane is due (bit_depth times per
+// frame). ShiftOutPixels() always shifts out the current plane, for arrays
+// sharing their latch with other shift registers.
+//
+// With higher bit depths, the frame gets too long for a fixed tick rate. In
+// this case, call WriteNextPlane() from a timer interrupt, and schedule the
+// next call after a delay proportional to the weight it returns.
+//
+// set_pixel() writes directly into the planes being displayed. To update
+// several pixels without tearing, compose the next frame in frame(), with
+// perceived brightness levels (0-255), and call Swap(). The levels are
+// gamma-corrected and converted into a second set of planes, which is
+// displayed from the beginning of the next refresh frame. Fade() does the
+// same, but interpolates between the current and the new frame over a number
+// of refresh frames, from Process() in the main loop. Swap() returns 0, and
+// Process() does nothing, while the previous frame has not been picked up by
+// the refresh interrupt.
+//
+// set_pixel() and SetPixels() disable interrupts while they write into the
+// front planes, since the refresh interrupt swaps them. Their changes are
+// discarded when a frame queued by Swap() or Fade() is displayed.
+template<
+    typename Latch,
+    typename Clock,
+    typename Data,
+    uint8_t num_regs = 1,
+    DataOrder order = LSB_FIRST,
+    uint8_t bit_depth = 4>
 class LedArray {
  public:
 
   enum {
     size = num_regs * 8,
-    max_intensity = 0x0f,
+    max_intensity = (1 << bit_depth) - 1,
   };
 
   LedArray() { }
   
   static inline void Init() {
     Register::Init();
+    front_ = 0;
+    swap_pending_ = 0;
+    fade_increment_ = 0;
     Clear();
+    memset(frame_, 0, size);
+    memset(shown_, 0, size);
+    plane_ = bit_depth - 1;
+    ticks_ = 0;
   }
 
   static inline void set_pixel(uint8_t index) {
-    pixels_[index] = max_intensity;
+    set_pixel(index, max_intensity);
   }
 
-  static inline void set_pixel(uint8_t index, uint8_t intensity) {
+  static void set_pixel(uint8_t index, uint8_t intensity) {
+    intensity &= max_intensity;
     pixels_[index] = intensity;
+    uint8_t mask = 0x80 >> (index & 7);
+    uint8_t old_sreg = SREG;
+    cli();
+    uint8_t* byte = &planes_[front_][0][index >> 3];
+    for (uint8_t b = 0; b < bit_depth; ++b) {
+      if (intensity & 1) {
+        *byte |= mask;
+      } else {
+        *byte &= ~mask;
+      }
+      intensity >>= 1;
+      byte += num_regs;
+    }
+    SREG = old_sreg;
   }
 
   static inline void clr_pixel(uint8_t index) {
-    pixels_[index] = 0;
+    set_pixel(index, 0);
   }
 
   static inline uint8_t pixel(uint8_t index) {
@@ -73,61 +131,231 @@ class LedArray {
   }
   
   static inline void Clear() {
-    memset(pixels_, 0, size);
+    SetPixels(0);
   }
   
   static inline void SetPixels(uint8_t intensity) {
+    intensity &= max_intensity;
     memset(pixels_, intensity, size);
+    uint8_t old_sreg = SREG;
+    cli();
+    for (uint8_t b = 0; b < bit_depth; ++b) {
+      memset(planes_[front_][b], intensity & (1 << b) ? 0xff : 0x00, num_regs);
+    }
+    SREG = old_sreg;
   }
   
   static inline void ShiftOutPixels() {
-    uint8_t threshold = refresh_cycle_ & max_intensity;
-    
-    uint8_t byte = 0;
-    uint8_t num_bits = 0;
-    
-    for (uint8_t i = 0; i < size; i++) {
-      byte <<= 1;
-      uint8_t intensity;
-      intensity = pixels_[i] & max_intensity;
-
-      if (intensity > threshold || intensity == max_intensity) {
-        byte |= 1;
-      }
-
-      ++num_bits;
-      if (num_bits == 8) {
-        Register::ShiftOut(byte);
-        num_bits = 0;
-        byte = 0;
-      }
+    if (!ticks_) {
+      NextPlane();
     }
-
-    ++refresh_cycle_;
+    --ticks_;
+    ShiftOutPlane();
   }
   
   static inline void Write() {
+    if (ticks_) {
+      --ticks_;
+      return;
+    }
+    NextPlane();
+    --ticks_;
     Begin();
-    ShiftOutPixels();
+    ShiftOutPlane();
     End();
   }
+
+  // Displays the next plane and returns its weight (1, 2, 4...).
+  static inline uint8_t WriteNextPlane() {
+    NextPlane();
+    ticks_ = 0;
+    Begin();
+    ShiftOutPlane();
+    End();
+    return 1 << plane_;
+  }
+
+  // The bit-planes can also be streamed by other drivers (for example
+  // SpiShiftRegisterChain). To be called from the refresh interrupt, which
+  // is the only place where the planes are swapped.
+  static inline const uint8_t* plane(uint8_t b) {
+    return planes_[front_][b];
+  }
   
-  uint8_t* pixels() { return pixels_; }
+  // Levels of the pixels, as set with set_pixel(). Read-only: the display is
+  // refreshed from the planes.
+  const uint8_t* pixels() { return pixels_; }
+
+  // Back buffer, in perceived brightness levels (0-255).
+  static inline uint8_t* frame() { return frame_; }
+
+  static inline void set_frame_pixel(uint8_t index, uint8_t level) {
+    frame_[index] = level;
+  }
+
+  // Returns 0, without doing anything, if the previous frame has not been
+  // displayed yet.
+  static inline uint8_t Swap() {
+    if (swap_pending_) {
+      return 0;
+    }
+    fade_increment_ = 0;
+    Render(frame_, frame_, 255);
+    return 1;
+  }
+
+  // Fades from the frame being displayed to frame() over num_frames refresh
+  // frames. When the frame cannot be swapped immediately, a fade of 0 or 1
+  // frame is completed by the next call to Process() instead.
+  static void Fade(uint8_t num_frames) {
+    if (num_frames <= 1 && Swap()) {
+      return;
+    }
+    memcpy(fade_from_, shown_, size);
+    fade_phase_ = 0;
+    fade_increment_ = num_frames > 1 ? 65535 / num_frames : 65535;
+  }
+
+  static inline uint8_t fading() { return fade_increment_ != 0; }
+  static inline uint8_t swap_pending() { return swap_pending_; }
+
+  // Renders the next step of the fade, if the previous one is displayed.
+  static void Process() {
+    if (!fade_increment_ || swap_pending_) {
+      return;
+    }
+    uint16_t phase = fade_phase_ + fade_increment_;
+    if (phase < fade_phase_ || phase >= 0xff00) {
+      phase = 0xffff;
+      fade_increment_ = 0;
+    }
+    fade_phase_ = phase;
+    Render(fade_from_, frame_, phase >> 8);
+  }
   
  private:
   typedef ShiftRegisterOutput<Latch, Clock, Data, 8, order> Register;
 
+  static inline void NextPlane() {
+    ++plane_;
+    if (plane_ == bit_depth) {
+      plane_ = 0;
+      if (swap_pending_) {
+        front_ ^= 1;
+        swap_pending_ = 0;
+      }
+    }
+    ticks_ = 1 << plane_;
+  }
+
+  static inline void ShiftOutPlane() {
+    const uint8_t* p = planes_[front_][plane_];
+    for (uint8_t i = 0; i < num_regs; ++i) {
+      Register::ShiftOut(p[i]);
+    }
+  }
+
+  // Converts a mix of two frames into the back planes, and queues them for
+  // display. The previous frame must have been picked up.
+  static void Render(const uint8_t* from, const uint8_t* to, uint8_t balance) {
+    uint8_t back = front_ ^ 1;
+    uint8_t index = 0;
+    for (uint8_t i = 0; i < num_regs; ++i) {
+      uint8_t bytes[bit_depth];
+      memset(bytes, 0, bit_depth);
+      for (uint8_t j = 0; j < 8; ++j) {
+        uint8_t level = balance == 255 ? to[index] :
+            U8Mix(from[index], to[index], balance);
+        shown_[index] = level;
+        ++index;
+        uint8_t intensity = LedGamma<bit_depth>(level);
+        for (uint8_t b = 0; b < bit_depth; ++b) {
+          bytes[b] = (bytes[b] << 1) | (intensity & 1);
+          intensity >>= 1;
+        }
+      }
+      for (uint8_t b = 0; b < bit_depth; ++b) {
+        planes_[back][b][i] = bytes[b];
+      }
+    }
+    swap_pending_ = 1;
+  }
+
   static uint8_t pixels_[size];
-  static uint8_t refresh_cycle_;
+  static uint8_t planes_[2][bit_depth][num_regs];
+  static uint8_t front_;
+  static volatile uint8_t swap_pending_;
+  static uint8_t plane_;
+  static uint8_t ticks_;
+
+  static uint8_t frame_[size];
+  static uint8_t shown_[size];
+  static uint8_t fade_from_[size];
+  static uint16_t fade_phase_;
+  static uint16_t fade_increment_;
 
   DISALLOW_COPY_AND_ASSIGN(LedArray);
 };
 
-template<typename Latch, typename Clock, typename Data, uint8_t num_regs, DataOrder order>
-uint8_t LedArray<Latch, Clock, Data, num_regs, order>::pixels_[size];
+/* static */
+template<typename Latch, typename Clock, typename Data, uint8_t num_regs,
+         DataOrder order, uint8_t bit_depth>
+uint8_t LedArray<Latch, Clock, Data, num_regs, order, bit_depth>::pixels_[
+    size];
+
+/* static */
+template<typename Latch, typename Clock, typename Data, uint8_t num_regs,
+         DataOrder order, uint8_t bit_depth>
+uint8_t LedArray<Latch, Clock, Data, num_regs, order, bit_depth>::planes_[
+    2][bit_depth][num_regs];
+
+/* static */
+template<typename Latch, typename Clock, typename Data, uint8_t num_regs,
+         DataOrder order, uint8_t bit_depth>
+uint8_t LedArray<Latch, Clock, Data, num_regs, order, bit_depth>::front_;
+
+/* static */
+template<typename Latch, typename Clock, typename Data, uint8_t num_regs,
+         DataOrder order, uint8_t bit_depth>
+volatile uint8_t LedArray<Latch, Clock, Data, num_regs, order,
+                          bit_depth>::swap_pending_;
+
+/* static */
+template<typename Latch, typename Clock, typename Data, uint8_t num_regs,
+         DataOrder order, uint8_t bit_depth>
+uint8_t LedArray<Latch, Clock, Data, num_regs, order, bit_depth>::plane_;
+
+/* static */
+template<typename Latch, typename Clock, typename Data, uint8_t num_regs,
+         DataOrder order, uint8_t bit_depth>
+uint8_t LedArray<Latch, Clock, Data, num_regs, order, bit_depth>::ticks_;
+
+/* static */
+template<typename Latch, typename Clock, typename Data, uint8_t num_regs,
+         DataOrder order, uint8_t bit_depth>
+uint8_t LedArray<Latch, Clock, Data, num_regs, order, bit_depth>::frame_[size];
+
+/* static */
+template<typename Latch, typename Clock, typename Data, uint8_t num_regs,
+         DataOrder order, uint8_t bit_depth>
+uint8_t LedArray<Latch, Clock, Data, num_regs, order, bit_depth>::shown_[size];
+
+/* static */
+template<typename Latch, typename Clock, typename Data, uint8_t num_regs,
+         DataOrder order, uint8_t bit_depth>
+uint8_t LedArray<Latch, Clock, Data, num_regs, order,
+                 bit_depth>::fade_from_[size];
+
+/* static */
+template<typename Latch, typename Clock, typename Data, uint8_t num_regs,
+         DataOrder order, uint8_t bit_depth>
+uint16_t LedArray<Latch, Clock, Data, num_regs, order, bit_depth>::fade_phase_;
 
-template<typename Latch, typename Clock, typename Data, uint8_t num_regs, DataOrder order>
-uint8_t LedArray<Latch, Clock, Data, num_regs, order>::refresh_cycle_;
+/* static */
+template<typename Latch, typename Clock, typename Data, uint8_t num_regs,
+         DataOrder order, uint8_t bit_depth>
+uint16_t LedArray<Latch, Clock, Data, num_regs, order,
+                  bit_depth>::fade_increment_;
 
 }  // namespace avrlib
 
@@ -0,0 +1,42 @@
+// Copyright 2012 Olivier Gillet.
+//
+// Author: Olivier Gillet (ol.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Gamma correction for LED intensities.
+
+#ifndef AVRLIB_DEVICES_LED_GAMMA_H_
+#define AVRLIB_DEVICES_LED_GAMMA_H_
+
+#include <avr/pgmspace.h>
+
+#include "avrlib/base.h"
+
+namespace avrlib {
+
+// 256-entry table, gamma = 2.2.
+extern const uint8_t led_gamma_table[] PROGMEM;
+
+// Converts a perceived brightness (0-255) into an intensity with bit_depth
+// bits. The lowest non-null levels are kept lit.
+template<uint8_t bit_depth>
+inline uint8_t LedGamma(uint8_t level) {
+  uint8_t intensity = pgm_read_byte(led_gamma_table + level) >> (8 - bit_depth);
+  return (level && !intensity) ? 1 : intensity;
+}
+
+}  // namespace avrlib
+
+#endif  // AVRLIB_DEVICES_LED_GAMMA_H_
@@ -0,0 +1,190 @@
+// Copyright 2012 Olivier Gillet.
+//
+// Author: Olivier Gillet (ol.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Interrupt-driven scanner for large arrays of pots behind 4051 multiplexers.
+//
+// num_muxes 4051s share the same address lines (driven by a Mux4051Port), and
+// their outputs are connected to consecutive ADC inputs starting at
+// first_input_index. Pot n is connected to input n % num_muxes of the mux
+// addressed by n / num_muxes.
+//
+// The next pot to convert is chosen at the end of the interrupt handler, so
+// that the next conversion is started as soon as the handler is entered. The
+// address lines are switched right before, when needed: the sample-and-hold
+// of the conversion which has just completed is long done, and the new
+// conversion only samples its input 1.5 ADC clock cycles after its start
+// (12us with the default /128 prescaler), which leaves plenty of time for the
+// mux outputs to settle. The handler never waits.
+//
+// Pots which have not moved for a while are considered idle, and are sampled
+// only once every idle_divider (a power of 2) scans, leaving more conversions
+// to the pots being played with. Readings use a deadband around the latest
+// stable value, as in HysteresisPotScanner.
+//
+// The interrupt handler must be installed by the application:
+//
+// ADC_CONVERSION_COMPLETE {
+//   Scanner::OnConversionComplete();
+// }
+
+#ifndef AVRLIB_DEVICES_MUXED_POT_SCANNER_H_
+#define AVRLIB_DEVICES_MUXED_POT_SCANNER_H_
+
+#include <string.h>
+
+#include "avrlib/adc.h"
+#include "avrlib/devices/mux4051.h"
+
+namespace avrlib {
+
+template<
+    typename Mux,
+    uint8_t num_muxes = 1,
+    uint8_t first_input_index = 0,
+    uint8_t threshold = 4,
+    uint8_t idle_divider = 4,
+    uint8_t idle_scans = 16>
+class MuxedPotScanner {
+ public:
+  enum {
+    num_pots = num_muxes * 8,
+    resolution = 10
+  };
+
+  MuxedPotScanner() { }
+
+  static void Init() {
+    STATIC_ASSERT(idle_divider && !(idle_divider & (idle_divider - 1)));
+    Mux::Init();
+    Mux::Enable();
+    Adc::Init();
+    Adc::set_alignment(ADC_RIGHT_ALIGNED);
+    memset((void*)(value_), 0, sizeof(value_));
+    memset(idle_count_, 0, sizeof(idle_count_));
+    scan_cycle_ = 0;
+    converting_ = 0;
+    next_ = FindNext(0);
+    Mux::Write(0);
+    Adc::EnableInterrupt();
+    Adc::StartConversion(first_input_index);
+  }
+
+  static void Done() {
+    Adc::DisableInterrupt();
+  }
+
+  // To be called from the ADC interrupt handler.
+  static inline void OnConversionComplete() {
+    uint16_t sample = Adc::ReadOut();
+    uint8_t pot = converting_;
+
+    // Start the next conversion right away.
+    converting_ = next_;
+    if (address(converting_) != address(pot)) {
+      Mux::Write(address(converting_));
+    }
+    Adc::StartConversion(first_input_index + input(converting_));
+
+    int16_t delta = static_cast<int16_t>(sample - value_[pot]);
+    if (delta < 0) {
+      delta = -delta;
+    }
+    if (delta >= threshold) {
+      value_[pot] = sample;
+      idle_count_[pot] = 0;
+    } else if (idle_count_[pot] < idle_scans) {
+      ++idle_count_[pot];
+    }
+
+    next_ = FindNext(converting_);
+  }
+
+  // The value is read twice to detect whether it has been modified by the
+  // interrupt handler in the meantime.
+  static inline uint16_t value(uint8_t index) {
+    uint16_t v;
+    do {
+      v = value_[index];
+    } while (v != value_[index]);
+    return v;
+  }
+
+  static inline uint8_t idle(uint8_t index) {
+    return idle_count_[index] >= idle_scans;
+  }
+
+ private:
+  static inline uint8_t address(uint8_t pot) {
+    return num_muxes == 1 ? pot : pot / num_muxes;
+  }
+
+  static inline uint8_t input(uint8_t pot) {
+    return num_muxes == 1 ? 0 : pot % num_muxes;
+  }
+
+  // Idle pots are due once every idle_divider scans. The pots are staggered,
+  // so that at most idle_divider pots are skipped in a row.
+  static inline uint8_t FindNext(uint8_t pot) {
+    while (1) {
+      ++pot;
+      if (pot == num_pots) {
+        pot = 0;
+        ++scan_cycle_;
+      }
+      if (!idle(pot) ||
+          ((scan_cycle_ + pot) & (idle_divider - 1)) == 0) {
+        return pot;
+      }
+    }
+  }
+
+  static volatile uint16_t value_[num_muxes * 8];
+  static uint8_t idle_count_[num_muxes * 8];
+  static uint8_t scan_cycle_;
+  static uint8_t converting_;
+  static uint8_t next_;
+
+  DISALLOW_COPY_AND_ASSIGN(MuxedPotScanner);
+};
+
+/* static */
+template<typename Mux, uint8_t num_muxes, uint8_t b, uint8_t c, uint8_t d,
+         uint8_t e>
+volatile uint16_t MuxedPotScanner<Mux, num_muxes, b, c, d, e>::value_[
+    num_muxes * 8];
+
+/* static */
+template<typename Mux, uint8_t num_muxes, uint8_t b, uint8_t c, uint8_t d,
+         uint8_t e>
+uint8_t MuxedPotScanner<Mux, num_muxes, b, c, d, e>::idle_count_[
+    num_muxes * 8];
+
+/* static */
+template<typename Mux, uint8_t a, uint8_t b, uint8_t c, uint8_t d, uint8_t e>
+uint8_t MuxedPotScanner<Mux, a, b, c, d, e>::scan_cycle_;
+
+/* static */
+template<typename Mux, uint8_t a, uint8_t b, uint8_t c, uint8_t d, uint8_t e>
+uint8_t MuxedPotScanner<Mux, a, b, c, d, e>::converting_;
+
+/* static */
+template<typename Mux, uint8_t a, uint8_t b, uint8_t c, uint8_t d, uint8_t e>
+uint8_t MuxedPotScanner<Mux, a, b, c, d, e>::next_;
+
+}  // namespace avrlib
+
+#endif  // AVRLIB_DEVICES_MUXED_POT_SCANNER_H_
@@ -19,6 +19,9 @@
 // to the ADC:
 // - PotScanner uses averaging.
 // - HysteresisPotScanner uses a deadband around the latest stable reading.
+//
+// Inputs are numbered as in Adc::set_channel, so on the ATmega640/1280/2560,
+// first_input_index + num_inputs can go up to 16.
 
 #ifndef AVRLIB_DEVICES_POT_SCANNER_H_
 #define AVRLIB_DEVICES_POT_SCANNER_H_
@@ -32,9 +35,13 @@ template<
     uint8_t num_inputs,
     uint8_t first_input_index = 0,
     uint8_t oversampling = 8,
-    uint8_t resolution = 7>
+    uint8_t resolution_bits = 7>
 class PotScanner {
  public:
+  enum {
+    resolution = resolution_bits
+  };
+
   PotScanner() { }
 
   static inline void Init() {
@@ -48,7 +55,7 @@ class PotScanner {
   }
   
   static inline void Read() {
-    uint8_t index = history_ptr_ + oversampling * scan_cycle_;
+    uint16_t index = history_ptr_ + oversampling * scan_cycle_;
     value_[scan_cycle_] -= history_[index];
     Adc::Wait();
     history_[index] = Adc::ReadOut8();
@@ -110,9 +117,13 @@ template<
     uint8_t num_inputs,
     uint8_t first_input_index = 0,
     uint8_t threshold = 8,
-    uint8_t resolution = 10>
+    uint8_t resolution_bits = 10>
 class HysteresisPotScanner {
  public:
+  enum {
+    resolution = resolution_bits
+  };
+
   HysteresisPotScanner() { }
 
   static inline void Init() {
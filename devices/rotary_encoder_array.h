@@ -18,25 +18,63 @@
 // -----------------------------------------------------------------------------
 //
 // Driver for an array of clickable rotary encoders.
-
+//
+// The quadrature signals are decoded with a transition table: the previous
+// and current states of the A and B contacts index a 16-entry table giving
+// the movement (-1, 0 or +1 quarter step). Invalid transitions (both contacts
+// changing at the same time) and contact bounce (back and forth between two
+// adjacent states) cancel out, so no debouncing is required, and no step is
+// missed as long as Poll() is called more often than the contacts change.
+//
+// The A and B contacts of all the encoders are read into two words, so idle
+// encoders are skipped with a single comparison. The detents are accumulated
+// until they are read, and the time between detents is used to accelerate
+// fast movements.
 #ifndef AVRLIB_DEVICES_ROTARY_ENCODER_ARRAY_H_
 #define AVRLIB_DEVICES_ROTARY_ENCODER_ARRAY_H_
 
 #include <string.h>
 
 #include "avrlib/gpio.h"
+#include "avrlib/size_to_type.h"
 #include "avrlib/time.h"
 
 namespace avrlib {
 
+// Unrolled polling loop: shifts the A, B and C inputs of encoder index - 1,
+// then index - 2... down to 0, so that encoder i ends up in bit i of a and b.
+template<typename Clock, typename A, typename B, typename C, typename T,
+         uint8_t index>
+struct UnrolledEncoderPoll {
+  static inline void Run(T* a, T* b, uint8_t* c) {
+    *a = (*a << 1) | A::value();
+    *b = (*b << 1) | B::value();
+    c[index - 1] = (c[index - 1] << 1) | C::value();
+    Clock::High();
+    Clock::Low();
+    UnrolledEncoderPoll<Clock, A, B, C, T, index - 1>::Run(a, b, c);
+  }
+};
+
+template<typename Clock, typename A, typename B, typename C, typename T>
+struct UnrolledEncoderPoll<Clock, A, B, C, T, 0> {
+  static inline void Run(T* a, T* b, uint8_t* c) { }
+};
+
+// steps_per_detent is the number of quadrature transitions between two
+// detents: 4 for most mechanical encoders (one full cycle, detent with both
+// contacts open), 2 or 1 for some others.
 template<
     typename Load,
     typename Clock,
     typename A,
     typename B,
     typename C,
-    uint8_t size = 8>
+    uint8_t size = 8,
+    uint8_t steps_per_detent = 4>
 class RotaryEncoderArray {
+  typedef typename DataTypeForSize<size>::Type T;
+
  public:
   RotaryEncoderArray() { }
   ~RotaryEncoderArray() { }
@@ -50,38 +88,54 @@ class RotaryEncoderArray {
     Load::High();
     Clock::Low();
 
-    memset(stateA_, 0xff, sizeof(stateA_));
-    memset(stateB_, 0xff, sizeof(stateB_));
+    a_ = ~T(0);
+    b_ = ~T(0);
     memset(stateC_, 0xff, sizeof(stateC_));
+    memset(steps_, 0, sizeof(steps_));
+    memset(increment_, 0, sizeof(increment_));
+    memset(accelerated_, 0, sizeof(accelerated_));
+    memset(direction_, 0, sizeof(direction_));
   }
 
-  // To catch all clicks this has to be called at rate 5KHz or higher. 
-  // This executes in 35us for 8 encoders at 20MHz.
+  // Can be called from an interrupt. The contacts of a quickly spun encoder
+  // stay in the same state for about 1ms, so this has to be called at 2kHz or
+  // higher.
   static void Poll() {
     Load::Low();
     Load::High();
 
-    for (uint8_t i = size; i--; ) {
-      stateA_[i] = (stateA_[i] << 1) | A::value();
-      stateB_[i] = (stateB_[i] << 1) | B::value();
-      stateC_[i] = (stateC_[i] << 1) | C::value();
-      Clock::High();
-      Clock::Low();
+    T a = 0;
+    T b = 0;
+    UnrolledEncoderPoll<Clock, A, B, C, T, size>::Run(&a, &b, stateC_);
+    T changed = (a ^ a_) | (b ^ b_);
+    if (changed) {
+      Decode(a, b, changed);
     }
+    a_ = a;
+    b_ = b;
   }
 
-  // This executes in 200ns at 20MHz
+  // Returns the number of detents the encoder has been turned by since the
+  // last call to Read or ReadAccelerated.
   static inline int8_t Read(uint8_t index) {
-    int8_t increment = 0;
-    uint8_t a = stateA_[index];
-    uint8_t b = stateB_[index];
-    if (a == 0x80 && ((b & 0xf0) == 0x00)) {
-        increment = 1;
-    } else {
-      if (b == 0x80 && (a & 0xf0) == 0x00) {
-        increment = -1;
-      }
-    }
+    uint8_t old_sreg = SREG;
+    cli();
+    int8_t increment = increment_[index];
+    increment_[index] = 0;
+    accelerated_[index] = 0;
+    SREG = old_sreg;
+    return increment;
+  }
+
+  // Same as Read, but each detent counts for 2, 4 or 8 when the encoder is
+  // turned quickly.
+  static inline int8_t ReadAccelerated(uint8_t index) {
+    uint8_t old_sreg = SREG;
+    cli();
+    int8_t increment = accelerated_[index];
+    increment_[index] = 0;
+    accelerated_[index] = 0;
+    SREG = old_sreg;
     return increment;
   }
 
@@ -102,38 +156,197 @@ class RotaryEncoderArray {
   }
 
  private:
-  static uint8_t stateA_[size];
-  static uint8_t stateB_[size];
+  static void Decode(T a, T b, T changed) {
+    T previous_a = a_;
+    T previous_b = b_;
+    for (uint8_t i = 0; changed; ++i) {
+      if (changed & 1) {
+        uint8_t state = ((a & 1) << 1) | (b & 1);
+        uint8_t transition = ((previous_a & 1) << 3) |
+            ((previous_b & 1) << 2) | state;
+        int8_t steps = steps_[i] + transitions_[transition];
+        if (steps_per_detent == 4 && state == 3) {
+          // Back in the rest position. Resynchronize, even if a transition
+          // has been missed on the way.
+          if (steps >= 2) {
+            Detent(i, 1);
+          } else if (steps <= -2) {
+            Detent(i, -1);
+          }
+          steps = 0;
+        } else if (steps >= static_cast<int8_t>(steps_per_detent)) {
+          Detent(i, 1);
+          steps -= steps_per_detent;
+        } else if (steps <= -static_cast<int8_t>(steps_per_detent)) {
+          Detent(i, -1);
+          steps += steps_per_detent;
+        }
+        steps_[i] = steps;
+      }
+      changed >>= 1;
+      a >>= 1;
+      b >>= 1;
+      previous_a >>= 1;
+      previous_b >>= 1;
+    }
+  }
+
+  static void Detent(uint8_t index, int8_t direction) {
+    uint16_t now = timer0_milliseconds.words[0];
+    uint16_t elapsed = now - last_detent_[index];
+    last_detent_[index] = now;
+
+    // Speed up only when the encoder keeps turning in the same direction.
+    int8_t multiplier = 1;
+    if (direction == direction_[index]) {
+      if (elapsed < 10) {
+        multiplier = 8;
+      } else if (elapsed < 25) {
+        multiplier = 4;
+      } else if (elapsed < 50) {
+        multiplier = 2;
+      }
+    }
+    direction_[index] = direction;
+
+    increment_[index] = Clip(increment_[index] + direction);
+    accelerated_[index] = Clip(accelerated_[index] + direction * multiplier);
+  }
+
+  static inline int8_t Clip(int16_t value) {
+    return value > 127 ? 127 : (value < -127 ? -127 : value);
+  }
+
+  static const int8_t transitions_[16];
+
+  static T a_;
+  static T b_;
   static uint8_t stateC_[size];
+  static int8_t steps_[size];
+  static volatile int8_t increment_[size];
+  static volatile int8_t accelerated_[size];
+  static int8_t direction_[size];
+  static uint16_t last_detent_[size];
 
   DISALLOW_COPY_AND_ASSIGN(RotaryEncoderArray);
 };
 
+// Indexed by previous A, previous B, A, B. The 11 -> 10 -> 00 -> 01 -> 11
+// sequence (B falls first, A follows) is a +1 movement, as in RotaryEncoder.
+/* static */
+template<
+    typename Load,
+    typename Clock,
+    typename A,
+    typename B,
+    typename C,
+    uint8_t size,
+    uint8_t steps_per_detent>
+const int8_t RotaryEncoderArray<Load, Clock, A, B, C, size,
+    steps_per_detent>::transitions_[16] = {
+  0, 1, -1, 0,
+  -1, 0, 0, 1,
+  1, 0, 0, -1,
+  0, -1, 1, 0
+};
+
+/* static */
 template<
     typename Load,
     typename Clock,
     typename A,
     typename B,
     typename C,
-    uint8_t size>
-  uint8_t RotaryEncoderArray<Load, Clock, A, B, C, size>::stateA_[size];
+    uint8_t size,
+    uint8_t steps_per_detent>
+typename RotaryEncoderArray<Load, Clock, A, B, C, size,
+    steps_per_detent>::T
+RotaryEncoderArray<Load, Clock, A, B, C, size, steps_per_detent>::a_;
 
+/* static */
 template<
     typename Load,
     typename Clock,
     typename A,
     typename B,
     typename C,
-    uint8_t size>
-  uint8_t RotaryEncoderArray<Load, Clock, A, B, C, size>::stateB_[size];
+    uint8_t size,
+    uint8_t steps_per_detent>
+typename RotaryEncoderArray<Load, Clock, A, B, C, size,
+    steps_per_detent>::T
+RotaryEncoderArray<Load, Clock, A, B, C, size, steps_per_detent>::b_;
 
+/* static */
 template<
     typename Load,
     typename Clock,
     typename A,
     typename B,
-    typename C, uint8_t size>
-  uint8_t RotaryEncoderArray<Load, Clock, A, B, C, size>::stateC_[size];
+    typename C,
+    uint8_t size,
+    uint8_t steps_per_detent>
+uint8_t
+RotaryEncoderArray<Load, Clock, A, B, C, size, steps_per_detent>::stateC_[size];
+
+/* static */
+template<
+    typename Load,
+    typename Clock,
+    typename A,
+    typename B,
+    typename C,
+    uint8_t size,
+    uint8_t steps_per_detent>
+int8_t
+RotaryEncoderArray<Load, Clock, A, B, C, size, steps_per_detent>::steps_[size];
+
+/* static */
+template<
+    typename Load,
+    typename Clock,
+    typename A,
+    typename B,
+    typename C,
+    uint8_t size,
+    uint8_t steps_per_detent>
+volatile int8_t
+RotaryEncoderArray<Load, Clock, A, B, C, size, steps_per_detent>::increment_[size];
+
+/* static */
+template<
+    typename Load,
+    typename Clock,
+    typename A,
+    typename B,
+    typename C,
+    uint8_t size,
+    uint8_t steps_per_detent>
+volatile int8_t
+RotaryEncoderArray<Load, Clock, A, B, C, size, steps_per_detent>::accelerated_[size];
+
+/* static */
+template<
+    typename Load,
+    typename Clock,
+    typename A,
+    typename B,
+    typename C,
+    uint8_t size,
+    uint8_t steps_per_detent>
+int8_t
+RotaryEncoderArray<Load, Clock, A, B, C, size, steps_per_detent>::direction_[size];
+
+/* static */
+template<
+    typename Load,
+    typename Clock,
+    typename A,
+    typename B,
+    typename C,
+    uint8_t size,
+    uint8_t steps_per_detent>
+uint16_t
+RotaryEncoderArray<Load, Clock, A, B, C, size, steps_per_detent>::last_detent_[size];
 
 }  // namespace avrlib
 
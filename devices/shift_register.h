@@ -26,6 +26,52 @@
 
 namespace avrlib {
 
+// Fully unrolled bit-banging sequences, generated at compile time. Each bit is
+// tested with a constant mask: there is no loop counter and no shifted mask.
+// The data pin is still set with a branch, so the duration of a bit may depend
+// on its value.
+template<typename Clock, typename Data, typename T,
+         int8_t bit, int8_t step, uint8_t remaining>
+struct UnrolledShiftOut {
+  static inline void Run(T data) {
+    Clock::Low();
+    if (data & (T(1) << bit)) {
+      Data::High();
+    } else {
+      Data::Low();
+    }
+    Clock::High();
+    UnrolledShiftOut<Clock, Data, T, bit + step, step, remaining - 1>::Run(
+        data);
+  }
+};
+
+template<typename Clock, typename Data, typename T, int8_t bit, int8_t step>
+struct UnrolledShiftOut<Clock, Data, T, bit, step, 0> {
+  static inline void Run(T data) { }
+};
+
+// Reads one bit per clock pulse, and stores it at position bit, then
+// bit + step...
+template<typename Clock, typename Data, typename T,
+         int8_t bit, int8_t step, uint8_t remaining>
+struct UnrolledShiftIn {
+  static inline void Run(T* data) {
+    if (Data::value()) {
+      *data |= T(1) << bit;
+    }
+    Clock::High();
+    Clock::Low();
+    UnrolledShiftIn<Clock, Data, T, bit + step, step, remaining - 1>::Run(
+        data);
+  }
+};
+
+template<typename Clock, typename Data, typename T, int8_t bit, int8_t step>
+struct UnrolledShiftIn<Clock, Data, T, bit, step, 0> {
+  static inline void Run(T* data) { }
+};
+
 template<typename Latch, typename Clock, typename Data>
 struct BaseShiftRegisterOutput {
   BaseShiftRegisterOutput() { }
@@ -47,14 +93,10 @@ template<typename Latch, typename Clock, typename Data,
 struct ShiftRegisterOutput<Latch, Clock, Data, size, LSB_FIRST>
   : public BaseShiftRegisterOutput<Latch, Clock, Data> {
   ShiftRegisterOutput() { }
-  static void ShiftOut(typename DataTypeForSize<size>::Type data) {
+  typedef typename DataTypeForSize<size>::Type T;
+  static void ShiftOut(T data) {
     Data::Low();
-    for (uint8_t i = size; i > 0; --i) {
-      Clock::Low();
-      Data::set_value(data & 1);
-      data >>= 1;
-      Clock::High();
-    }
+    UnrolledShiftOut<Clock, Data, T, 0, 1, size>::Run(data);
     Clock::Low();
   }
   static void Begin() {
@@ -77,17 +119,7 @@ struct ShiftRegisterOutput<Latch, Clock, Data, size, MSB_FIRST>
   typedef typename DataTypeForSize<size>::Type T;
   static void ShiftOut(T data) {
     Data::Low();
-    T mask = (T(1) << (size - 1));
-    for (uint8_t i = size; i > 0; --i) {
-      Clock::Low();
-      if (data & mask) {
-        Data::High();
-      } else {
-        Data::Low();
-      }
-      mask >>= 1;
-      Clock::High();
-    }
+    UnrolledShiftOut<Clock, Data, T, size - 1, -1, size>::Run(data);
     Clock::Low();
   }
   static void Begin() {
@@ -131,12 +163,7 @@ struct ShiftRegisterInput<Load, Clock, Data, size, LSB_FIRST>
     // Strobe load pin.
     Load::Low();
     Load::High();
-    for (uint8_t i = size; i > 0; --i) {
-      data <<= 1;
-      data |= Data::value();
-      Clock::High();
-      Clock::Low();
-    }
+    UnrolledShiftIn<Clock, Data, T, size - 1, -1, size>::Run(&data);
     return data;
   }
 };
@@ -147,19 +174,11 @@ struct ShiftRegisterInput<Load, Clock, Data, size, MSB_FIRST>
   ShiftRegisterInput() { }
   typedef typename DataTypeForSize<size>::Type T;
   static T Read() {
-    T mask = 1;
     T data = 0;
     // Strobe load pin.
     Load::Low();
     Load::High();
-    for (uint8_t i = size; i > 0; --i) {
-      if (Data::value()) {
-        data |= mask;
-      }
-      Clock::High();
-      mask <<= 1;
-      Clock::Low();
-    }
+    UnrolledShiftIn<Clock, Data, T, 0, 1, size>::Run(&data);
     return data;
   }
 };
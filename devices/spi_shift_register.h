@@ -0,0 +1,188 @@
+// Copyright 2012 Olivier Gillet.
+//
+// Author: Olivier Gillet (ol.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Drivers for chains of shift registers (74HC595 for output, 74HC165 for
+// input) clocked by the hardware SPI (SpiMaster) or by a USART in master SPI
+// mode (UartSpiMaster), one byte at a time. The slave select pin of the SPI
+// interface is used as the latch (595) or load (165) signal.
+//
+// The bit order is the one the SPI interface is configured with. The data is
+// sent in whole bytes: size is rounded up to a multiple of 8.
+//
+// SpiShiftRegisterOutput and SpiShiftRegisterInput have the same interface as
+// ShiftRegisterOutput and ShiftRegisterInput. SpiShiftRegisterChain streams
+// a whole chain from a frame buffer, either synchronously or from the
+// transfer complete interrupt:
+//
+// typedef SpiShiftRegisterChain<SpiMaster<Gpio<PortB, 2>, MSB_FIRST, 2>, 4>
+//     Leds;
+//
+// SPI_RECEIVE {
+//   Leds::OnTransferComplete();
+// }
+//
+// Leds::Stream(frame);
+
+#ifndef AVRLIB_DEVICES_SPI_SHIFT_REGISTER_H_
+#define AVRLIB_DEVICES_SPI_SHIFT_REGISTER_H_
+
+#include "avrlib/spi.h"
+
+namespace avrlib {
+
+template<typename Spi, uint8_t size = 8, DataOrder order = MSB_FIRST>
+struct SpiShiftRegisterOutput {
+  typedef typename DataTypeForSize<size>::Type T;
+  enum {
+    num_bytes = (size + 7) / 8
+  };
+
+  SpiShiftRegisterOutput() { }
+
+  static void Init() {
+    Spi::Init();
+  }
+
+  // order is the order in which the bytes of a 16, 24 or 32-bit value are
+  // sent.
+  static inline void ShiftOut(T data) {
+    for (uint8_t i = 0; i < num_bytes; ++i) {
+      if (order == MSB_FIRST) {
+        Spi::Send(data >> (8 * (num_bytes - 1 - i)));
+      } else {
+        Spi::Send(data >> (8 * i));
+      }
+    }
+  }
+
+  static inline void Begin() {
+    Spi::Begin();
+  }
+
+  // The latch is strobed once the last bit has been shifted out.
+  static inline void End() {
+    Spi::Flush();
+    Spi::End();
+  }
+
+  static inline void Write(T data) {
+    Begin();
+    ShiftOut(data);
+    End();
+  }
+};
+
+// Requires an SPI interface with a Receive() method (SpiMaster).
+template<typename Spi, uint8_t size = 8, DataOrder order = MSB_FIRST>
+struct SpiShiftRegisterInput {
+  typedef typename DataTypeForSize<size>::Type T;
+  enum {
+    num_bytes = (size + 7) / 8
+  };
+
+  SpiShiftRegisterInput() { }
+
+  static void Init() {
+    Spi::Init();
+  }
+
+  static inline T Read() {
+    // Strobe load pin.
+    Spi::Begin();
+    Spi::End();
+    T data = 0;
+    for (uint8_t i = 0; i < num_bytes; ++i) {
+      T byte = Spi::Receive();
+      if (order == MSB_FIRST) {
+        data = (data << 8) | byte;
+      } else {
+        data |= byte << (8 * i);
+      }
+    }
+    return data;
+  }
+};
+
+template<typename Spi, uint8_t num_bytes>
+class SpiShiftRegisterChain {
+ public:
+  SpiShiftRegisterChain() { }
+
+  static void Init() {
+    Spi::Init();
+    remaining_ = 0;
+    busy_ = 0;
+  }
+
+  static void Write(const uint8_t* data) {
+    Spi::Begin();
+    for (uint8_t i = 0; i < num_bytes; ++i) {
+      Spi::Send(data[i]);
+    }
+    Spi::Flush();
+    Spi::End();
+  }
+
+  // Starts streaming a frame from the transfer complete interrupt. The frame
+  // must not be modified before busy() returns 0.
+  static void Stream(const uint8_t* data) {
+    while (busy_);
+    busy_ = 1;
+    Spi::Begin();
+    data_ = data + 1;
+    remaining_ = num_bytes - 1;
+    Spi::EnableTransferInterrupt();
+    Spi::Overwrite(data[0]);
+  }
+
+  // To be called from the SPI transfer complete interrupt.
+  static inline void OnTransferComplete() {
+    if (remaining_) {
+      --remaining_;
+      Spi::Overwrite(*data_++);
+    } else {
+      Spi::DisableTransferInterrupt();
+      Spi::End();
+      busy_ = 0;
+    }
+  }
+
+  static inline uint8_t busy() { return busy_; }
+
+ private:
+  static const uint8_t* data_;
+  static volatile uint8_t remaining_;
+  static volatile uint8_t busy_;
+
+  DISALLOW_COPY_AND_ASSIGN(SpiShiftRegisterChain);
+};
+
+/* static */
+template<typename Spi, uint8_t num_bytes>
+const uint8_t* SpiShiftRegisterChain<Spi, num_bytes>::data_;
+
+/* static */
+template<typename Spi, uint8_t num_bytes>
+volatile uint8_t SpiShiftRegisterChain<Spi, num_bytes>::remaining_;
+
+/* static */
+template<typename Spi, uint8_t num_bytes>
+volatile uint8_t SpiShiftRegisterChain<Spi, num_bytes>::busy_;
+
+}  // namespace avrlib
+
+#endif  // AVRLIB_DEVICES_SPI_SHIFT_REGISTER_H_
@@ -66,6 +66,16 @@ template<typename Input, bool enable_pull_up>
 uint8_t DebouncedSwitch<Input, enable_pull_up>::state_;
 
 
+// Debouncing of an array of switches behind shift registers, with vertical
+// counters: bit i of the words cnt0_ and cnt1_ is a 2-bit counter of the
+// number of consecutive samples for which switch i has differed from its
+// debounced state. When it reaches 4, the debounced state is toggled. All the
+// switches are processed in parallel with a handful of bitwise operations.
+//
+// Switch i is bit num_inputs - 1 - i of the words read from the shift
+// registers, and of the masks returned by pressed(), released() and
+// debounced(). The switches are expected to be active low (pull-ups): pressed
+// is a high to low transition.
 template<typename Load, typename Clock, typename Data, uint8_t num_inputs, DataOrder order = LSB_FIRST>
 class DebouncedSwitches {
   typedef typename DataTypeForSize<num_inputs>::Type T;
@@ -77,7 +87,9 @@ class DebouncedSwitches {
 
   static inline void Init() {
     Register::Init();
-    memset(state_, 0xff, sizeof(state_));
+    debounced_ = ~T(0);
+    cnt0_ = cnt1_ = 0;
+    pressed_ = released_ = 0;
   }
   
   static inline T ReadRegister() {
@@ -85,25 +97,58 @@ class DebouncedSwitches {
   }
   
   static inline void Process(T value) {
-    T mask = 1 << (num_inputs - 1);
-    for (uint8_t i = 0; i < num_inputs; ++i) {
-      state_[i] <<= 1;
-      if (value & mask) {
-         state_[i] |= 1;
-      }
-      mask >>= 1;
-    }
+    // The bits of the word which are not connected to a switch are ignored.
+    // ~T(0) is promoted to int: the cast keeps the shift logical.
+    T mask = static_cast<T>(~T(0)) >> (8 * sizeof(T) - num_inputs);
+    T delta = (value ^ debounced_) & mask;
+    // Increment the counters of the switches which differ from their debounced
+    // state, reset the others.
+    cnt1_ = (cnt1_ ^ cnt0_) & delta;
+    cnt0_ = ~cnt0_ & delta;
+    T toggle = delta & ~(cnt0_ | cnt1_);
+    debounced_ ^= toggle;
+    pressed_ = toggle & ~debounced_;
+    released_ = toggle & debounced_;
   }
   
   static inline void Read() {
     Process(ReadRegister());
   }
+
+  // Masks of the switches which have been pressed/released during the last
+  // call to Process.
+  static inline T pressed() { return pressed_; }
+  static inline T released() { return released_; }
+  static inline T debounced() { return debounced_; }
+
+  // Index of the first switch pressed during the last call to Process, -1 if
+  // none.
+  static inline int8_t first_pressed() {
+    return FirstSet(pressed_);
+  }
   
-  static inline uint8_t lowered(uint8_t index) { return state_[index] == 0x80; }
-  static inline uint8_t raised(uint8_t index) { return state_[index] == 0x7f; }
-  static inline uint8_t high(uint8_t index) { return state_[index] == 0xff; }
-  static inline uint8_t low(uint8_t index) { return state_[index] == 0x00; }
-  static inline uint8_t state(uint8_t index) { return state_[index]; }
+  static inline uint8_t lowered(uint8_t index) {
+    return (pressed_ & mask(index)) ? 1 : 0;
+  }
+  static inline uint8_t raised(uint8_t index) {
+    return (released_ & mask(index)) ? 1 : 0;
+  }
+  static inline uint8_t high(uint8_t index) {
+    return (debounced_ & ~released_ & mask(index)) ? 1 : 0;
+  }
+  static inline uint8_t low(uint8_t index) {
+    return (~debounced_ & ~pressed_ & mask(index)) ? 1 : 0;
+  }
+  // Compatibility with the shift register based history of the previous
+  // implementation: 0xff (high), 0x7f (raised), 0x00 (low), 0x80 (lowered).
+  static inline uint8_t state(uint8_t index) {
+    if (lowered(index)) {
+      return 0x80;
+    } else if (raised(index)) {
+      return 0x7f;
+    }
+    return (debounced_ & mask(index)) ? 0xff : 0x00;
+  }
   static inline int8_t event(uint8_t index) {
     if (lowered(index)) {
       return -1;
@@ -114,13 +159,65 @@ class DebouncedSwitches {
   }
 
  private:
-  static uint8_t state_[num_inputs];
+  static inline T mask(uint8_t index) {
+    return T(1) << (num_inputs - 1 - index);
+  }
+
+  // Scans the mask one byte at a time, from the first switch, skipping the
+  // empty bytes.
+  static int8_t FirstSet(T bits) {
+    int8_t index = 0;
+    uint8_t shift = num_inputs;
+    while (shift) {
+      uint8_t chunk = shift >= 8 ? 8 : shift;
+      shift -= chunk;
+      uint8_t byte = (bits >> shift) & ((1 << chunk) - 1);
+      if (byte) {
+        uint8_t bit = 1 << (chunk - 1);
+        while (!(byte & bit)) {
+          bit >>= 1;
+          ++index;
+        }
+        return index;
+      }
+      index += chunk;
+    }
+    return -1;
+  }
+
+  static T debounced_;
+  static T cnt0_;
+  static T cnt1_;
+  static T pressed_;
+  static T released_;
 
   DISALLOW_COPY_AND_ASSIGN(DebouncedSwitches);
 };
 
+/* static */
+template<typename Load, typename Clock, typename Data, uint8_t num_inputs, DataOrder order>
+typename DebouncedSwitches<Load, Clock, Data, num_inputs, order>::T
+DebouncedSwitches<Load, Clock, Data, num_inputs, order>::debounced_;
+
+/* static */
+template<typename Load, typename Clock, typename Data, uint8_t num_inputs, DataOrder order>
+typename DebouncedSwitches<Load, Clock, Data, num_inputs, order>::T
+DebouncedSwitches<Load, Clock, Data, num_inputs, order>::cnt0_;
+
+/* static */
+template<typename Load, typename Clock, typename Data, uint8_t num_inputs, DataOrder order>
+typename DebouncedSwitches<Load, Clock, Data, num_inputs, order>::T
+DebouncedSwitches<Load, Clock, Data, num_inputs, order>::cnt1_;
+
+/* static */
+template<typename Load, typename Clock, typename Data, uint8_t num_inputs, DataOrder order>
+typename DebouncedSwitches<Load, Clock, Data, num_inputs, order>::T
+DebouncedSwitches<Load, Clock, Data, num_inputs, order>::pressed_;
+
+/* static */
 template<typename Load, typename Clock, typename Data, uint8_t num_inputs, DataOrder order>
-uint8_t DebouncedSwitches<Load, Clock, Data, num_inputs, order>::state_[num_inputs];
+typename DebouncedSwitches<Load, Clock, Data, num_inputs, order>::T
+DebouncedSwitches<Load, Clock, Data, num_inputs, order>::released_;
 
 }  // namespace avrlib
 
@@ -0,0 +1,65 @@
+// Copyright 2012 Olivier Gillet.
+//
+// Author: Olivier Gillet (ol.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Onboard EEPROM, with the same block R/W interface as ExternalEeprom, so that
+// code written for one can be used with the other.
+
+#ifndef AVRLIB_EEPROM_H_
+#define AVRLIB_EEPROM_H_
+
+#include <avr/eeprom.h>
+
+#include "avrlib/base.h"
+
+namespace avrlib {
+
+class InternalEeprom {
+ public:
+  InternalEeprom() { }
+
+  static inline void Init() { }
+
+  static inline uint16_t Read(uint16_t address, uint16_t size, uint8_t* data) {
+    eeprom_read_block(data, reinterpret_cast<const void*>(address), size);
+    return size;
+  }
+
+  static inline uint8_t Read(uint16_t address) {
+    return eeprom_read_byte(reinterpret_cast<const uint8_t*>(address));
+  }
+
+  // Only the bytes which differ from the EEPROM content are written.
+  static inline uint16_t Write(
+      uint16_t address,
+      const uint8_t* data,
+      uint16_t size) {
+    eeprom_update_block(data, reinterpret_cast<void*>(address), size);
+    return size;
+  }
+
+  static inline uint8_t Write(uint16_t address, uint8_t byte) {
+    eeprom_update_byte(reinterpret_cast<uint8_t*>(address), byte);
+    return 1;
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(InternalEeprom);
+};
+
+}  // namespace avrlib
+
+#endif  // AVRLIB_EEPROM_H_
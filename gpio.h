@@ -57,12 +57,18 @@ IORegister(PINC);
 IORegister(PIND);
 
 // Represents a i/o port, which has input, output and mode registers.
+// Extended ports are mapped above I/O address 0x3F (ports H to L on the
+// ATmega640/1280/2560): their registers cannot be accessed with sbi/cbi, so a
+// bit write is a non-atomic load/modify/store sequence.
 template<typename InputRegister, typename OutputRegister,
-         typename ModeRegister>
+         typename ModeRegister, uint8_t extended_io = 0>
 struct Port {
   typedef InputRegister Input;
   typedef OutputRegister Output;
   typedef ModeRegister Mode;
+  enum {
+    extended = extended_io
+  };
 };
 
 // Definition of I/O ports.
@@ -107,30 +113,57 @@ IORegister(PINL);
 typedef Port<PINERegister, PORTERegister, DDRERegister> PortE;
 typedef Port<PINFRegister, PORTFRegister, DDRFRegister> PortF;
 typedef Port<PINGRegister, PORTGRegister, DDRGRegister> PortG;
-typedef Port<PINHRegister, PORTHRegister, DDRHRegister> PortH;
-typedef Port<PINJRegister, PORTJRegister, DDRJRegister> PortJ;
-typedef Port<PINKRegister, PORTKRegister, DDRKRegister> PortK;
-typedef Port<PINLRegister, PORTLRegister, DDRLRegister> PortL;
+typedef Port<PINHRegister, PORTHRegister, DDRHRegister, 1> PortH;
+typedef Port<PINJRegister, PORTJRegister, DDRJRegister, 1> PortJ;
+typedef Port<PINKRegister, PORTKRegister, DDRKRegister, 1> PortK;
+typedef Port<PINLRegister, PORTLRegister, DDRLRegister, 1> PortL;
 
 #endif
 
 
+// All the supported MCUs toggle an output when 1 is written to its PINx bit.
+// Older parts (ATmega8/16/32/128...) do not, and should leave this undefined.
+#define HAS_PIN_TOGGLE
+
 // The actual implementation of a pin, not very convenient to use because it
 // requires the actual parameters of the pin to be passed as template
 // arguments.
+//
+// Writes are safe with respect to interrupt handlers writing to other pins of
+// the same port: sbi/cbi on the lower I/O ports, and a short sequence with
+// interrupts disabled on the extended ports. atomic_toggle is 0 for the pins
+// which cannot be toggled by a single write to PINx, and for which Toggle()
+// falls back to a read-modify-write with interrupts disabled.
 template<typename Port, typename PwmChannel, uint8_t bit>
 struct GpioImpl {
   typedef BitInRegister<typename Port::Mode, bit> ModeBit;
   typedef BitInRegister<typename Port::Output, bit> OutputBit;
   typedef BitInRegister<typename Port::Input, bit> InputBit;
   typedef PwmChannel Pwm;
+  typedef Port PinPort;
+  enum {
+    pin_mask = 1 << bit,
+    atomic_write = !Port::extended,
+#ifdef HAS_PIN_TOGGLE
+    atomic_toggle = 1
+#else
+    atomic_toggle = 0
+#endif  // HAS_PIN_TOGGLE
+  };
 
   static inline void set_mode(uint8_t mode) {
+    uint8_t old_sreg = SREG;
+    if (!atomic_write) {
+      cli();
+    }
     if (mode == DIGITAL_INPUT) {
       ModeBit::clear();
     } else if (mode == DIGITAL_OUTPUT || mode == PWM_OUTPUT) {
       ModeBit::set();
     }
+    if (!atomic_write) {
+      SREG = old_sreg;
+    }
     if (mode == PWM_OUTPUT) {
       PwmChannel::Start();
     } else {
@@ -139,13 +172,34 @@ struct GpioImpl {
   }
 
   static inline void High() {
-    OutputBit::set();
+    if (atomic_write) {
+      OutputBit::set();
+    } else {
+      uint8_t old_sreg = SREG;
+      cli();
+      OutputBit::set();
+      SREG = old_sreg;
+    }
   }
   static inline void Low() {
-    OutputBit::clear();
+    if (atomic_write) {
+      OutputBit::clear();
+    } else {
+      uint8_t old_sreg = SREG;
+      cli();
+      OutputBit::clear();
+      SREG = old_sreg;
+    }
   }
   static inline void Toggle() {
-    OutputBit::toggle();
+    if (atomic_toggle) {
+      *Port::Input::ptr() = pin_mask;
+    } else {
+      uint8_t old_sreg = SREG;
+      cli();
+      OutputBit::toggle();
+      SREG = old_sreg;
+    }
   }
   static inline void set_value(uint8_t value) {
     if (value == 0) {
@@ -178,6 +232,12 @@ struct GpioImpl {
 template<typename port, uint8_t bit>
 struct Gpio {
   typedef GpioImpl<port, NoPwmChannel, bit> Impl;
+  typedef port PinPort;
+  enum {
+    pin_mask = 1 << bit,
+    atomic_write = Impl::atomic_write,
+    atomic_toggle = Impl::atomic_toggle
+  };
   static void High() { Impl::High(); }
   static void Low() { Impl::Low(); }
   static void Toggle() { Impl::Toggle(); }
@@ -190,6 +250,11 @@ struct Gpio {
 };
 
 struct DummyGpio {
+  // Never accessed by PinGroup, since its mask is null.
+  typedef PortB PinPort;
+  enum {
+    pin_mask = 0
+  };
   static void High() { }
   static void Low() { }
   static void set_mode(uint8_t mode) { }
@@ -232,6 +297,160 @@ struct DigitalInput {
   }
 };
 
+template<typename A, typename B>
+struct SameType {
+  enum {
+    value = 0
+  };
+};
+
+template<typename A>
+struct SameType<A, A> {
+  enum {
+    value = 1
+  };
+};
+
+// A group of up to 8 pins, possibly on different ports, written with a single
+// read-modify-write per port instead of one per pin. The port masks are
+// computed at compile time. Bit i of the value written is the state of pin i.
+//
+// typedef PinGroup<Gpio<PortB, 0>, Gpio<PortB, 1>, Gpio<PortD, 7> > Pins;
+// Pins::set_mode(DIGITAL_OUTPUT);
+// Pins::Write(0x05);  // PB0 and PD7 high, PB1 low.
+//
+// Beware that the pins change state simultaneously: this is not suitable for
+// signals with setup/hold constraints relative to each other (for example the
+// data and strobe lines of a parallel bus).
+template<typename P0,
+         typename P1 = DummyGpio,
+         typename P2 = DummyGpio,
+         typename P3 = DummyGpio,
+         typename P4 = DummyGpio,
+         typename P5 = DummyGpio,
+         typename P6 = DummyGpio,
+         typename P7 = DummyGpio>
+struct PinGroup {
+  // Mask of the pins of the group which are on a given port.
+  template<typename Port>
+  struct PortMask {
+    enum {
+      value =
+          (SameType<typename P0::PinPort, Port>::value ? P0::pin_mask : 0) |
+          (SameType<typename P1::PinPort, Port>::value ? P1::pin_mask : 0) |
+          (SameType<typename P2::PinPort, Port>::value ? P2::pin_mask : 0) |
+          (SameType<typename P3::PinPort, Port>::value ? P3::pin_mask : 0) |
+          (SameType<typename P4::PinPort, Port>::value ? P4::pin_mask : 0) |
+          (SameType<typename P5::PinPort, Port>::value ? P5::pin_mask : 0) |
+          (SameType<typename P6::PinPort, Port>::value ? P6::pin_mask : 0) |
+          (SameType<typename P7::PinPort, Port>::value ? P7::pin_mask : 0)
+    };
+  };
+
+  // Index of the first pin of the group on a given port. This pin is the one
+  // in charge of writing to the port.
+  template<typename Port>
+  struct FirstPin {
+    enum {
+      value =
+          SameType<typename P0::PinPort, Port>::value ? 0 :
+          SameType<typename P1::PinPort, Port>::value ? 1 :
+          SameType<typename P2::PinPort, Port>::value ? 2 :
+          SameType<typename P3::PinPort, Port>::value ? 3 :
+          SameType<typename P4::PinPort, Port>::value ? 4 :
+          SameType<typename P5::PinPort, Port>::value ? 5 :
+          SameType<typename P6::PinPort, Port>::value ? 6 : 7
+    };
+  };
+
+  static inline void High() { Write(0xff); }
+  static inline void Low() { Write(0); }
+
+  static inline void Write(uint8_t value) {
+    WritePort<P0, 0>(value);
+    WritePort<P1, 1>(value);
+    WritePort<P2, 2>(value);
+    WritePort<P3, 3>(value);
+    WritePort<P4, 4>(value);
+    WritePort<P5, 5>(value);
+    WritePort<P6, 6>(value);
+    WritePort<P7, 7>(value);
+  }
+
+  // Same as Write, with interrupts disabled, for ports also written to by an
+  // ISR.
+  static inline void AtomicWrite(uint8_t value) {
+    uint8_t old_sreg = SREG;
+    cli();
+    Write(value);
+    SREG = old_sreg;
+  }
+
+  static inline void set_mode(uint8_t mode) {
+    uint8_t value = mode == DIGITAL_INPUT ? 0 : 0xff;
+    SetModePort<P0, 0>(value);
+    SetModePort<P1, 1>(value);
+    SetModePort<P2, 2>(value);
+    SetModePort<P3, 3>(value);
+    SetModePort<P4, 4>(value);
+    SetModePort<P5, 5>(value);
+    SetModePort<P6, 6>(value);
+    SetModePort<P7, 7>(value);
+  }
+
+ private:
+  // Bits to set in the output register of a port, for a given value.
+  template<typename Port>
+  static inline uint8_t Bits(uint8_t value) {
+    uint8_t bits = 0;
+    if (SameType<typename P0::PinPort, Port>::value && (value & 0x01)) {
+      bits |= P0::pin_mask;
+    }
+    if (SameType<typename P1::PinPort, Port>::value && (value & 0x02)) {
+      bits |= P1::pin_mask;
+    }
+    if (SameType<typename P2::PinPort, Port>::value && (value & 0x04)) {
+      bits |= P2::pin_mask;
+    }
+    if (SameType<typename P3::PinPort, Port>::value && (value & 0x08)) {
+      bits |= P3::pin_mask;
+    }
+    if (SameType<typename P4::PinPort, Port>::value && (value & 0x10)) {
+      bits |= P4::pin_mask;
+    }
+    if (SameType<typename P5::PinPort, Port>::value && (value & 0x20)) {
+      bits |= P5::pin_mask;
+    }
+    if (SameType<typename P6::PinPort, Port>::value && (value & 0x40)) {
+      bits |= P6::pin_mask;
+    }
+    if (SameType<typename P7::PinPort, Port>::value && (value & 0x80)) {
+      bits |= P7::pin_mask;
+    }
+    return bits;
+  }
+
+  template<typename Pin, uint8_t index>
+  static inline void WritePort(uint8_t value) {
+    typedef typename Pin::PinPort Port;
+    uint8_t mask = PortMask<Port>::value;
+    if (FirstPin<Port>::value == index && mask) {
+      volatile uint8_t* reg = Port::Output::ptr();
+      *reg = (*reg & ~mask) | Bits<Port>(value);
+    }
+  }
+
+  template<typename Pin, uint8_t index>
+  static inline void SetModePort(uint8_t value) {
+    typedef typename Pin::PinPort Port;
+    uint8_t mask = PortMask<Port>::value;
+    if (FirstPin<Port>::value == index && mask) {
+      volatile uint8_t* reg = Port::Mode::ptr();
+      *reg = (*reg & ~mask) | Bits<Port>(value);
+    }
+  }
+};
+
 // A template that will be specialized for each pin, allowing the pin number to
 // be specified as a template parameter.
 template<int n>
@@ -327,11 +546,6 @@ typedef Gpio<PortD, 2> UartSpi1RX;
 #define HAS_USART0
 #define HAS_USART1
 
-#if defined(ATMEGA1284P) || defined(ATMEGA640) || defined(ATMEGA1280)  \
-	|| defined(ATMEGA2560)
-#define HAS_TIMER3
-#endif
-
 #elif defined (ATMEGA640) || defined(ATMEGA1280) || defined(ATMEGA2560)
 
 SetupGpio(0,  PortB, NoPwmChannel, 0);
@@ -462,6 +676,12 @@ typedef Gpio<PortJ, 0> UartSpi3RX;
 template<int n>
 struct NumberedGpio {
   typedef typename NumberedGpioInternal<n>::Impl Impl;
+  typedef typename Impl::PinPort PinPort;
+  enum {
+    pin_mask = Impl::pin_mask,
+    atomic_write = Impl::atomic_write,
+    atomic_toggle = Impl::atomic_toggle
+  };
   static void High() { Impl::High(); }
   static void Low() { Impl::Low(); }
   static void set_mode(uint8_t mode) { Impl::set_mode(mode); }
@@ -147,6 +147,22 @@ class I2cMaster {
     return size;
   }
 
+  // Addresses a slave for writing, without sending any data. The slave
+  // acknowledging (Wait() returning I2C_ERROR_NONE) indicates that it is
+  // ready - this is used for acknowledge polling on EEPROMs.
+  static uint8_t Ping(uint8_t address) {
+    if (state_ != I2C_STATE_READY) {
+      return 0;
+    }
+
+    error_ = I2C_ERROR_NONE;
+    state_ = I2C_STATE_TRANSMITTING;
+    slarw_ = (address << 1) | TW_WRITE;
+    I2cStart::set();
+
+    return 1;
+  }
+
   static uint8_t Request(uint8_t address, uint8_t requested) {
     // Make sure that we don't request more than the buffer can hold.
     if (requested >= Input::writable()) {
@@ -183,6 +199,14 @@ class I2cMaster {
   static inline void FlushInputBuffer() { Input::Flush(); }
   static inline void FlushOutputBuffer() { Output::Flush(); }
 
+  // The completion handler is called from the interrupt handler whenever a
+  // transaction terminates, successfully or not. It can start another
+  // transaction, which allows a sequence of transfers to be chained without
+  // involvement from the main loop.
+  static inline void set_completion_handler(void (*handler)()) {
+    completion_handler_ = handler;
+  }
+
  private:
   static inline void Continue(uint8_t ack) {
     if (ack) {
@@ -196,11 +220,17 @@ class I2cMaster {
     I2cStop::set();
     while (I2cStop::value()) { }
     state_ = I2C_STATE_READY;
+    if (completion_handler_) {
+      (*completion_handler_)();
+    }
   }
 
   static inline void Abort() {
     TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT);
     state_ = I2C_STATE_READY;
+    if (completion_handler_) {
+      (*completion_handler_)();
+    }
   }
 
   static void Handler() {
@@ -270,6 +300,7 @@ private:
   static volatile uint8_t slarw_;
   static volatile uint8_t received_;
   static uint8_t requested_;
+  static void (*completion_handler_)();
 
   DISALLOW_COPY_AND_ASSIGN(I2cMaster);
 };
@@ -302,6 +333,12 @@ template<uint8_t input_buffer_size, uint8_t output_buffer_size,
          uint32_t frequency>
 uint8_t I2cMaster<input_buffer_size, output_buffer_size, frequency>::requested_;
 
+/* static */
+template<uint8_t input_buffer_size, uint8_t output_buffer_size,
+         uint32_t frequency>
+void (*I2cMaster<input_buffer_size, output_buffer_size,
+                 frequency>::completion_handler_)() = NULL;
+
 }  // namespace avrlib
 
 #endif   // AVRLIB_I2C_I2C_H_
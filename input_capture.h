@@ -0,0 +1,282 @@
+// Copyright 2012 Olivier Gillet.
+//
+// Author: Olivier Gillet (ol.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Period/frequency measurement with the input capture unit of a 16-bit timer.
+//
+// The edges on the ICPn pin are timestamped by the hardware, so the
+// measurement is not affected by the interrupt latency. The ISR extends the
+// 16-bit capture value to 32 bits with a count of timer overflows, and pushes
+// it into a ring buffer. The periods are computed in the main loop.
+//
+// Both interrupt handlers must be installed by the application:
+//
+// TIMER_1_CAPTURE {
+//   Capture::OnCapture();
+// }
+//
+// TIMER_1_TICK {
+//   Capture::OnOverflow();
+// }
+//
+// while (Capture::Process()) {
+//   ...
+// }
+
+#ifndef AVRLIB_INPUT_CAPTURE_H_
+#define AVRLIB_INPUT_CAPTURE_H_
+
+#include "avrlib/base.h"
+#include "avrlib/ring_buffer.h"
+#include "avrlib/timer.h"
+
+namespace avrlib {
+
+// prescaler is the value of the CSn2..0 bits: 1 = clk, 2 = clk/8, 3 = clk/64,
+// 4 = clk/256, 5 = clk/1024. With the default settings (clk/8 at 16 MHz), the
+// resolution is 0.5us, and the signal is considered lost after about 2s
+// without edges.
+template<int timer = 1,
+         uint8_t buffer_size_ = 8,
+         uint8_t prescaler = 2,
+         uint8_t smoothing = 3,
+         uint16_t timeout_overflows = 64>
+class InputCapture {
+ public:
+  typedef InputCapture<timer, buffer_size_, prescaler, smoothing,
+                       timeout_overflows> Me;
+  typedef Timer16<timer> CaptureTimer;
+  typedef uint32_t Value;
+  typedef RingBuffer<Me> Edges;
+
+  enum {
+    buffer_size = buffer_size_,
+    data_size = 32
+  };
+
+  InputCapture() { }
+
+  static void Init() {
+    Init(1);
+  }
+
+  static void Init(uint8_t rising_edge) {
+    overflows_ = 0;
+    last_edge_ = 0;
+    period_ = 0;
+    average_period_ = 0;
+    num_edges_ = 0;
+    num_dropped_ = 0;
+    CaptureTimer::set_mode(TIMER16_NORMAL);
+    CaptureTimer::set_prescaler(prescaler);
+    CaptureTimer::set_input_capture_edge(rising_edge);
+    CaptureTimer::set_input_capture_noise_canceler(1);
+    CaptureTimer::StartInputCapture();
+    CaptureTimer::Start();
+  }
+
+  // Timer clock, in Hz.
+  static inline uint32_t clock() {
+    return F_CPU >> (prescaler == 1 ? 0 : (prescaler == 2 ? 3 :
+        (prescaler == 3 ? 6 : (prescaler == 4 ? 8 : 10))));
+  }
+
+  // To be called from the timer overflow interrupt.
+  static inline void OnOverflow() {
+    ++overflows_;
+  }
+
+  // To be called from the input capture interrupt.
+  static inline void OnCapture() {
+    uint16_t low = CaptureTimer::icr();
+    uint16_t high = overflows_;
+    // The timer has overflowed but the overflow interrupt has not been
+    // serviced yet. If the capture occurred after the overflow (small capture
+    // value), the overflow has to be accounted for.
+    if (CaptureTimer::overflow_pending() && low < 0x8000) {
+      ++high;
+    }
+    if (!Edges::NonBlockingWrite((static_cast<uint32_t>(high) << 16) | low)) {
+      ++num_dropped_;
+    }
+  }
+
+  // Processes the timestamps from the buffer until a new period has been
+  // measured. Returns 1 if this is the case.
+  static uint8_t Process() {
+    while (Edges::readable()) {
+      uint32_t edge = Edges::ImmediateRead();
+      uint32_t period = edge - last_edge_;
+      last_edge_ = edge;
+      if (!num_edges_) {
+        num_edges_ = 1;
+        continue;
+      }
+      period_ = period;
+      if (average_period_ == 0) {
+        average_period_ = period << smoothing;
+      } else {
+        average_period_ = average_period_ - (average_period_ >> smoothing) +
+            period;
+      }
+      return 1;
+    }
+    if (num_edges_ && timed_out()) {
+      num_edges_ = 0;
+      period_ = 0;
+      average_period_ = 0;
+    }
+    return 0;
+  }
+
+  // Latest period, in timer ticks. 0 if no signal.
+  static inline uint32_t period() { return period_; }
+
+  // Period averaged over the last 2^smoothing edges, in timer ticks.
+  static inline uint32_t average_period() {
+    return average_period_ >> smoothing;
+  }
+
+  // Averaged frequency, in hundredths of Hz. 0 if no signal.
+  static inline uint32_t frequency() {
+    uint32_t p = average_period();
+    return p ? clock() * 100 / p : 0;
+  }
+
+  static inline uint32_t last_edge() { return last_edge_; }
+  static inline uint8_t num_dropped() { return num_dropped_; }
+
+  // Returns true if no edge has been received for timeout_overflows timer
+  // overflows (about 2s with the default settings).
+  static uint8_t timed_out() {
+    uint8_t old_sreg = SREG;
+    cli();
+    uint16_t now = overflows_;
+    SREG = old_sreg;
+    return static_cast<uint16_t>(now - (last_edge_ >> 16)) >
+        timeout_overflows;
+  }
+
+ private:
+  static volatile uint16_t overflows_;
+  static uint32_t last_edge_;
+  static uint32_t period_;
+  static uint32_t average_period_;
+  static uint8_t num_edges_;
+  static volatile uint8_t num_dropped_;
+
+  DISALLOW_COPY_AND_ASSIGN(InputCapture);
+};
+
+/* static */
+template<int timer, uint8_t buffer_size_, uint8_t prescaler, uint8_t smoothing,
+         uint16_t timeout_overflows>
+volatile uint16_t InputCapture<timer, buffer_size_, prescaler, smoothing,
+    timeout_overflows>::overflows_;
+
+/* static */
+template<int timer, uint8_t buffer_size_, uint8_t prescaler, uint8_t smoothing,
+         uint16_t timeout_overflows>
+uint32_t InputCapture<timer, buffer_size_, prescaler, smoothing,
+    timeout_overflows>::last_edge_;
+
+/* static */
+template<int timer, uint8_t buffer_size_, uint8_t prescaler, uint8_t smoothing,
+         uint16_t timeout_overflows>
+uint32_t InputCapture<timer, buffer_size_, prescaler, smoothing,
+    timeout_overflows>::period_;
+
+/* static */
+template<int timer, uint8_t buffer_size_, uint8_t prescaler, uint8_t smoothing,
+         uint16_t timeout_overflows>
+uint32_t InputCapture<timer, buffer_size_, prescaler, smoothing,
+    timeout_overflows>::average_period_;
+
+/* static */
+template<int timer, uint8_t buffer_size_, uint8_t prescaler, uint8_t smoothing,
+         uint16_t timeout_overflows>
+uint8_t InputCapture<timer, buffer_size_, prescaler, smoothing,
+    timeout_overflows>::num_edges_;
+
+/* static */
+template<int timer, uint8_t buffer_size_, uint8_t prescaler, uint8_t smoothing,
+         uint16_t timeout_overflows>
+volatile uint8_t InputCapture<timer, buffer_size_, prescaler, smoothing,
+    timeout_overflows>::num_dropped_;
+
+// Follows the tempo of an external clock with ppqn pulses per quarter note.
+// Small deviations (jitter) are smoothed out, large ones (tempo change, clock
+// restart) are followed immediately.
+template<typename Capture, uint8_t ppqn = 24, uint8_t smoothing = 3>
+class TempoFollower {
+ public:
+  TempoFollower() { }
+
+  static void Init() {
+    Capture::Init();
+    estimate_ = 0;
+  }
+
+  // Returns 1 if a clock pulse has been received since the last call.
+  static uint8_t Process() {
+    uint8_t received = 0;
+    while (Capture::Process()) {
+      uint32_t period = Capture::period();
+      uint32_t current = estimate_ >> smoothing;
+      uint32_t deviation = period > current ?
+          period - current : current - period;
+      if (deviation > (current >> 3)) {
+        estimate_ = period << smoothing;
+      } else {
+        estimate_ = estimate_ - (estimate_ >> smoothing) + period;
+      }
+      received = 1;
+    }
+    if (!Capture::period()) {
+      estimate_ = 0;
+    }
+    return received;
+  }
+
+  static inline uint8_t locked() { return estimate_ != 0; }
+
+  // Estimated duration of a clock pulse, in timer ticks.
+  static inline uint32_t period() { return estimate_ >> smoothing; }
+
+  // Timestamp at which the next pulse is expected.
+  static inline uint32_t next_pulse() {
+    return Capture::last_edge() + period();
+  }
+
+  // Tempo in tenths of BPM. 0 if no clock is received.
+  static inline uint16_t bpm() {
+    uint32_t p = period();
+    return p ? (Capture::clock() / ppqn * 600) / p : 0;
+  }
+
+ private:
+  static uint32_t estimate_;
+
+  DISALLOW_COPY_AND_ASSIGN(TempoFollower);
+};
+
+/* static */
+template<typename Capture, uint8_t ppqn, uint8_t smoothing>
+uint32_t TempoFollower<Capture, ppqn, smoothing>::estimate_;
+
+}  // namespace avrlib
+
+#endif  // AVRLIB_INPUT_CAPTURE_H_
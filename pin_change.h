@@ -0,0 +1,188 @@
+// Copyright 2012 Olivier Gillet.
+//
+// Author: Olivier Gillet (ol.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Pin change interrupts. Instead of polling inputs at a high rate, the state
+// of the port is captured, with a timestamp, whenever one of the monitored
+// pins changes, and pushed into a ring buffer to be decoded in the main loop.
+// The interrupt handler only stores the raw timer0 tick count (long_ticks());
+// Read() converts it to microseconds.
+//
+// The pins are given as a mask on a port. For example, for a gate input on
+// PD2 and a trigger input on PD3:
+//
+// typedef PinChangeInput<PortD, 0x0c> Gates;
+//
+// PIN_CHANGE_INTERRUPT_2 {
+//   Gates::OnPinChange();
+// }
+//
+// while (Gates::readable()) {
+//   PinChangeEvent e = Gates::Read();
+//   ...
+// }
+//
+// The interrupt vector to use depends on the MCU and port (see the
+// PinChangePort definitions below).
+
+#ifndef AVRLIB_PIN_CHANGE_H_
+#define AVRLIB_PIN_CHANGE_H_
+
+#include <avr/interrupt.h>
+
+#include "avrlib/avrlib.h"
+#include "avrlib/gpio.h"
+#include "avrlib/ring_buffer.h"
+#include "avrlib/time.h"
+
+namespace avrlib {
+
+SpecialFunctionRegister(PCICR);
+SpecialFunctionRegister(PCIFR);
+SpecialFunctionRegister(PCMSK0);
+SpecialFunctionRegister(PCMSK1);
+SpecialFunctionRegister(PCMSK2);
+
+// Maps a port to its pin change interrupt. shift is the position of bit 0 of
+// the port in the PCMSKn register.
+template<typename Port>
+struct PinChangePort { };
+
+#define SetupPinChangePort(port, n, s) \
+template<> struct PinChangePort<port> { \
+  typedef PCMSK##n##Register Mask; \
+  enum { index = n, shift = s }; };
+
+#if defined(ATMEGA48P) || defined(ATMEGA88P) || defined(ATMEGA168P) || defined(ATMEGA328P)
+
+SetupPinChangePort(PortB, 0, 0);
+SetupPinChangePort(PortC, 1, 0);
+SetupPinChangePort(PortD, 2, 0);
+
+#elif defined(ATMEGA164P) || defined(ATMEGA324P) || defined(ATMEGA644P) || defined(ATMEGA1284P)
+
+SpecialFunctionRegister(PCMSK3);
+
+SetupPinChangePort(PortA, 0, 0);
+SetupPinChangePort(PortB, 1, 0);
+SetupPinChangePort(PortC, 2, 0);
+SetupPinChangePort(PortD, 3, 0);
+
+#elif defined (ATMEGA640) || defined(ATMEGA1280) || defined(ATMEGA2560)
+
+// PCINT8 is PE0, PCINT9 to PCINT15 are PJ0 to PJ6. PE0 (shared with RXD0) and
+// PJ7 are not supported.
+SetupPinChangePort(PortB, 0, 0);
+SetupPinChangePort(PortJ, 1, 1);
+SetupPinChangePort(PortK, 2, 0);
+
+#endif
+
+#undef SetupPinChangePort
+
+#define PIN_CHANGE_INTERRUPT_0 ISR(PCINT0_vect)
+#define PIN_CHANGE_INTERRUPT_1 ISR(PCINT1_vect)
+#define PIN_CHANGE_INTERRUPT_2 ISR(PCINT2_vect)
+#define PIN_CHANGE_INTERRUPT_3 ISR(PCINT3_vect)
+
+struct PinChangeEvent {
+  uint32_t time;  // Timer0 ticks in the buffer, microseconds once Read().
+  uint8_t state;
+};
+
+template<typename Port, uint8_t mask, uint8_t buffer_size_ = 16>
+class PinChangeInput {
+ public:
+  typedef PinChangeInput<Port, mask, buffer_size_> Me;
+  typedef PinChangePort<Port> Interrupt;
+  typedef PinChangeEvent Value;
+  typedef RingBuffer<Me> Events;
+
+  enum {
+    buffer_size = buffer_size_,
+    data_size = 8
+  };
+
+  PinChangeInput() { }
+
+  static void Init() {
+    Init(0);
+  }
+
+  static void Init(uint8_t pull_up) {
+    *Port::Mode::ptr() &= ~mask;
+    if (pull_up) {
+      *Port::Output::ptr() |= mask;
+    }
+    state_ = *Port::Input::ptr() & mask;
+    num_dropped_ = 0;
+    *Interrupt::Mask::ptr() |= mask << Interrupt::shift;
+    *PCIFRRegister::ptr() = _BV(Interrupt::index);
+    *PCICRRegister::ptr() |= _BV(Interrupt::index);
+  }
+
+  static void Done() {
+    *Interrupt::Mask::ptr() &= ~(mask << Interrupt::shift);
+    if (!*Interrupt::Mask::ptr()) {
+      *PCICRRegister::ptr() &= ~_BV(Interrupt::index);
+    }
+  }
+
+  // To be called from the pin change interrupt. Several PinChangeInputs can
+  // share the same interrupt vector.
+  static inline void OnPinChange() {
+    uint8_t state = *Port::Input::ptr() & mask;
+    if (state == state_) {
+      return;
+    }
+    state_ = state;
+    PinChangeEvent e;
+    e.time = long_ticks();
+    e.state = state;
+    if (!Events::NonBlockingWrite(e)) {
+      ++num_dropped_;
+    }
+  }
+
+  static inline uint8_t readable() { return Events::readable(); }
+  static inline PinChangeEvent Read() {
+    PinChangeEvent e = Events::ImmediateRead();
+    e.time = TicksToMicroseconds(e.time);
+    return e;
+  }
+
+  // Latest state of the pins, as seen by the interrupt handler.
+  static inline uint8_t state() { return state_; }
+  static inline uint8_t num_dropped() { return num_dropped_; }
+
+ private:
+  static volatile uint8_t state_;
+  static volatile uint8_t num_dropped_;
+
+  DISALLOW_COPY_AND_ASSIGN(PinChangeInput);
+};
+
+/* static */
+template<typename Port, uint8_t mask, uint8_t buffer_size_>
+volatile uint8_t PinChangeInput<Port, mask, buffer_size_>::state_;
+
+/* static */
+template<typename Port, uint8_t mask, uint8_t buffer_size_>
+volatile uint8_t PinChangeInput<Port, mask, buffer_size_>::num_dropped_;
+
+}  // namespace avrlib
+
+#endif  // AVRLIB_PIN_CHANGE_H_
@@ -0,0 +1,157 @@
+// Copyright 2012 Olivier Gillet.
+//
+// Author: Olivier Gillet (ol.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// PWM output ports for AudioOutput, with more than 8 bits of resolution.
+//
+// HighResolutionPwmOutput uses a 16-bit timer in fast PWM mode, with ICRn as
+// top. At 16 MHz, the PWM frequency is 15.6 kHz at 10 bits, 31.2 kHz at 9
+// bits. The samples are 16-bit; the bits below the PWM resolution can be
+// fed back into the next sample (PWM_ERROR_FEEDBACK, first-order noise
+// shaping), which pushes the quantization noise towards the high end of the
+// spectrum, where it is removed by the output filter. No dither noise is
+// added. The timer overflow interrupt (TIMER_n_TICK) can be used as the
+// emission interrupt.
+//
+// DualPwmOutput splits a 16-bit sample into two 8-bit PWMs, to be mixed with
+// resistors in a 1:256 ratio (for example 1k and 256k) before the output
+// filter. The two pins are given by their number, as for PwmOutput, and must
+// be on the same timer, so that their periods are aligned. The timer is set
+// to fast PWM with a period of 256 ticks and no prescaler (78.1 kHz at
+// 20 MHz) - so timer 0 cannot be used along with milliseconds().
+
+#ifndef AVRLIB_PWM_OUTPUT_H_
+#define AVRLIB_PWM_OUTPUT_H_
+
+#include "avrlib/base.h"
+#include "avrlib/gpio.h"
+#include "avrlib/timer.h"
+
+namespace avrlib {
+
+enum PwmNoiseShaping {
+  PWM_NO_NOISE_SHAPING,
+  PWM_ERROR_FEEDBACK
+};
+
+enum PwmOutputChannel {
+  PWM_CHANNEL_A,
+  PWM_CHANNEL_B,
+  PWM_CHANNEL_C
+};
+
+template<int timer,
+         typename Pin,
+         PwmOutputChannel channel = PWM_CHANNEL_A,
+         uint8_t resolution = 10,
+         PwmNoiseShaping noise_shaping = PWM_NO_NOISE_SHAPING>
+class HighResolutionPwmOutput {
+ public:
+  enum {
+    buffer_size = 0,
+    data_size = 16,
+    shift = 16 - resolution,
+    error_mask = (1 << (16 - resolution)) - 1
+  };
+  typedef Timer16<timer> PwmTimer;
+
+  HighResolutionPwmOutput() { }
+
+  static void Init() {
+    Pin::set_mode(DIGITAL_OUTPUT);
+    error_ = 0;
+    PwmTimer::set_prescaler(1);
+    PwmTimer::set_mode_fast_pwm_icr((1 << resolution) - 1);
+    Write(0x8000);
+    // Non-inverting output on the selected channel: COMnx1 set.
+    *PwmTimer::Impl::A::ptr() |= channel == PWM_CHANNEL_A ? _BV(7) :
+        (channel == PWM_CHANNEL_B ? _BV(5) : _BV(3));
+  }
+
+  static inline void Write(uint16_t value) {
+    if (noise_shaping == PWM_ERROR_FEEDBACK) {
+      uint16_t shaped = value + error_;
+      // Saturate instead of wrapping around.
+      if (shaped < value) {
+        shaped = 0xffff;
+      }
+      error_ = shaped & error_mask;
+      value = shaped;
+    }
+    value >>= shift;
+    if (channel == PWM_CHANNEL_A) {
+      PwmTimer::set_ocr_a(value);
+    } else if (channel == PWM_CHANNEL_B) {
+      PwmTimer::set_ocr_b(value);
+    } else {
+      PwmTimer::set_ocr_c(value);
+    }
+  }
+
+ private:
+  static uint16_t error_;
+
+  DISALLOW_COPY_AND_ASSIGN(HighResolutionPwmOutput);
+};
+
+/* static */
+template<int timer, typename Pin, PwmOutputChannel channel, uint8_t resolution,
+         PwmNoiseShaping noise_shaping>
+uint16_t HighResolutionPwmOutput<timer, Pin, channel, resolution,
+                                 noise_shaping>::error_;
+
+// high_pin and low_pin are pin numbers, for example 11 and 3 (OC2A and OC2B)
+// on an ATmega328p.
+template<int high_pin, int low_pin>
+class DualPwmOutput {
+ public:
+  enum {
+    buffer_size = 0,
+    data_size = 16
+  };
+
+  DualPwmOutput() { }
+
+  static void Init() {
+    PwmTimer::set_prescaler(1);
+    if (sizeof(typename PwmTimer::Impl::Value) == 2) {
+      // 16-bit timer: fast PWM, 8-bit (WGMn3..0 = 0101).
+      *PwmTimer::Impl::A::ptr() = (*PwmTimer::Impl::A::ptr() & 0xfc) | 0x01;
+      *PwmTimer::Impl::B::ptr() = (*PwmTimer::Impl::B::ptr() & 0xe7) | 0x08;
+    } else {
+      PwmTimer::set_mode(TIMER_FAST_PWM);
+    }
+    Write(0x8000);
+    NumberedGpio<high_pin>::set_mode(PWM_OUTPUT);
+    NumberedGpio<low_pin>::set_mode(PWM_OUTPUT);
+  }
+
+  static inline void Write(uint16_t value) {
+    High::Write(value >> 8);
+    Low::Write(value & 0xff);
+  }
+
+ private:
+  typedef typename NumberedGpio<high_pin>::Impl::Pwm High;
+  typedef typename NumberedGpio<low_pin>::Impl::Pwm Low;
+  typedef typename High::PwmTimer PwmTimer;
+
+  DISALLOW_COPY_AND_ASSIGN(DualPwmOutput);
+};
+
+}  // namespace avrlib
+
+#endif  // AVRLIB_PWM_OUTPUT_H_
@@ -0,0 +1,406 @@
+// Copyright 2012 Olivier Gillet.
+//
+// Author: Olivier Gillet (ol.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Log-structured key/record store, for saving settings to an EEPROM without
+// rewriting the same cells over and over again.
+//
+// Storage is either InternalEeprom or ExternalEeprom (anything with the
+// Read(address, size, data) / Write(address, data, size) block interface).
+// The area is split into two segments. Records are appended to the active
+// segment; when it is full, the latest version of each record is copied to
+// the other segment, which then becomes the active one (lazy compaction).
+//
+// Segment layout:
+// 'R' 'S' | first sequence number (16 bits) | CRC (16 bits)
+// key | length | sequence number (16 bits) | payload... | CRC (16 bits)
+// key | length | sequence number (16 bits) | payload... | CRC (16 bits)
+// ...
+//
+// Within a segment, sequence numbers are consecutive. The log ends at the
+// first record with an invalid key, an unexpected sequence number, or a bad
+// CRC (CRC-CCITT) - so a write interrupted by a power failure is simply
+// discarded, and stale records left in a segment by an older generation are
+// ignored without having to erase them. The segment header is written last
+// during compaction, so the switch from one segment to the other is atomic.
+//
+// The store only relies on the Storage interface and has no dependency on
+// avr-libc, so it can be tested on the host against a fake storage (see
+// test/record_store).
+//
+// The address of the latest version of each record is kept in RAM, so lookups
+// do not require scanning the log.
+
+#ifndef AVRLIB_RECORD_STORE_H_
+#define AVRLIB_RECORD_STORE_H_
+
+#include <string.h>
+
+#include "avrlib/base.h"
+
+namespace avrlib {
+
+static const uint16_t kRecordStoreNoRecord = 0xffff;
+static const uint16_t kRecordStoreCrcSeed = 0xffff;
+
+// CRC-CCITT (reflected, polynomial 0x8408), as _crc_ccitt_update from
+// avr-libc.
+static inline uint16_t RecordStoreCrcUpdate(uint16_t crc, uint8_t data) {
+  data ^= crc & 0xff;
+  data ^= data << 4;
+  return ((static_cast<uint16_t>(data) << 8) | (crc >> 8)) ^
+      static_cast<uint8_t>(data >> 4) ^
+      (static_cast<uint16_t>(data) << 3);
+}
+
+template<typename Storage,
+         uint16_t base_address = 0,
+         uint16_t storage_size = 1024,
+         uint8_t num_keys = 16>
+class RecordStore {
+ public:
+  enum {
+    segment_size = storage_size / 2,
+    segment_header_size = 6,
+    record_header_size = 4,
+    record_overhead = record_header_size + 2,
+    chunk_size = 16
+  };
+
+  RecordStore() { }
+
+  // Locates the active segment and rebuilds the index. Formats the storage
+  // area if no valid segment is found.
+  static void Init() {
+    uint16_t sequence_0;
+    uint16_t sequence_1;
+    uint8_t valid_0 = ReadSegmentHeader(0, &sequence_0);
+    uint8_t valid_1 = ReadSegmentHeader(1, &sequence_1);
+    if (!valid_0 && !valid_1) {
+      Format();
+      return;
+    }
+    if (valid_0 && valid_1) {
+      segment_ = static_cast<int16_t>(sequence_1 - sequence_0) > 0 ? 1 : 0;
+    } else {
+      segment_ = valid_1 ? 1 : 0;
+    }
+    Scan(segment_ ? sequence_1 : sequence_0);
+  }
+
+  // Discards all records. The first record slot of segment 0 is invalidated
+  // before its header is rewritten, so that records left from an earlier use
+  // of the segment cannot be found again by Scan(). The sequence numbers keep
+  // increasing, so if power fails before segment 1 is invalidated, segment 0
+  // is still the newest one.
+  static void Format() {
+    uint8_t invalid_key = 0xff;
+    Storage::Write(segment_start(0) + segment_header_size, &invalid_key, 1);
+    WriteSegmentHeader(0, sequence_);
+    uint8_t invalid_header = 0;
+    Storage::Write(segment_start(1), &invalid_header, 1);
+    segment_ = 0;
+    memset(index_, 0xff, sizeof(index_));
+    write_ptr_ = segment_start(0) + segment_header_size;
+  }
+
+  static inline uint8_t has_record(uint8_t key) {
+    return key < num_keys && index_[key] != kRecordStoreNoRecord;
+  }
+
+  // Size of the payload of a record, 0 if the record does not exist.
+  static uint8_t size(uint8_t key) {
+    if (!has_record(key)) {
+      return 0;
+    }
+    uint8_t header[record_header_size];
+    Storage::Read(index_[key], record_header_size, header);
+    return header[1];
+  }
+
+  // Reads at most max_size bytes from a record. Returns the number of bytes
+  // read.
+  static uint8_t Read(uint8_t key, uint8_t* data, uint8_t max_size) {
+    uint8_t record_size = size(key);
+    if (record_size > max_size) {
+      record_size = max_size;
+    }
+    if (record_size) {
+      Storage::Read(index_[key] + record_header_size, record_size, data);
+    }
+    return record_size;
+  }
+
+  // Appends a new version of a record - unless it is identical to the
+  // current one. Returns 0 if there is not enough room.
+  static uint8_t Write(uint8_t key, const uint8_t* data, uint8_t size) {
+    if (key >= num_keys) {
+      return 0;
+    }
+    if (Matches(key, data, size)) {
+      return 1;
+    }
+    uint16_t record_size = size + record_overhead;
+    if (write_ptr_ + record_size > segment_end(segment_)) {
+      if (!Compact() ||
+          write_ptr_ + record_size > segment_end(segment_)) {
+        return 0;
+      }
+    }
+    uint8_t header[record_header_size];
+    header[0] = key;
+    header[1] = size;
+    header[2] = sequence_ & 0xff;
+    header[3] = sequence_ >> 8;
+    uint16_t crc = Crc(kRecordStoreCrcSeed, header, record_header_size);
+    crc = Crc(crc, data, size);
+    uint8_t crc_bytes[2];
+    crc_bytes[0] = crc & 0xff;
+    crc_bytes[1] = crc >> 8;
+    uint16_t address = write_ptr_;
+    if (Storage::Write(address, header, record_header_size) !=
+            record_header_size ||
+        Storage::Write(address + record_header_size, data, size) != size ||
+        Storage::Write(address + record_header_size + size, crc_bytes, 2) !=
+            2) {
+      return 0;
+    }
+    index_[key] = address;
+    write_ptr_ += record_size;
+    ++sequence_;
+    return 1;
+  }
+
+  // Copies the latest version of each record to the other segment, and makes
+  // it the active one. Called automatically when the active segment is full,
+  // but can also be called when the application is idle.
+  static uint8_t Compact() {
+    uint8_t target = segment_ ^ 1;
+    uint16_t sequence = sequence_;
+    uint16_t write_ptr = segment_start(target) + segment_header_size;
+    uint16_t index[num_keys];
+    for (uint8_t key = 0; key < num_keys; ++key) {
+      index[key] = kRecordStoreNoRecord;
+      if (index_[key] == kRecordStoreNoRecord) {
+        continue;
+      }
+      uint16_t copied = CopyRecord(index_[key], write_ptr, target, sequence);
+      if (!copied) {
+        return 0;
+      }
+      index[key] = write_ptr;
+      write_ptr += copied;
+      ++sequence;
+    }
+    if (!WriteSegmentHeader(target, sequence_)) {
+      return 0;
+    }
+    sequence_ = sequence;
+    segment_ = target;
+    write_ptr_ = write_ptr;
+    memcpy(index_, index, sizeof(index_));
+    return 1;
+  }
+
+  static inline uint16_t free_space() {
+    return segment_end(segment_) - write_ptr_;
+  }
+
+ private:
+  static inline uint16_t segment_start(uint8_t segment) {
+    return base_address + (segment ? segment_size : 0);
+  }
+
+  static inline uint16_t segment_end(uint8_t segment) {
+    return segment_start(segment) + segment_size;
+  }
+
+  static inline uint16_t Crc(
+      uint16_t crc,
+      const uint8_t* data,
+      uint8_t size) {
+    while (size--) {
+      crc = RecordStoreCrcUpdate(crc, *data++);
+    }
+    return crc;
+  }
+
+  static uint8_t ReadSegmentHeader(uint8_t segment, uint16_t* sequence) {
+    uint8_t header[segment_header_size];
+    Storage::Read(segment_start(segment), segment_header_size, header);
+    if (header[0] != 'R' || header[1] != 'S' ||
+        Crc(kRecordStoreCrcSeed, header, segment_header_size - 2) !=
+            (header[4] | (header[5] << 8))) {
+      return 0;
+    }
+    *sequence = header[2] | (header[3] << 8);
+    return 1;
+  }
+
+  static uint8_t WriteSegmentHeader(uint8_t segment, uint16_t sequence) {
+    uint8_t header[segment_header_size];
+    header[0] = 'R';
+    header[1] = 'S';
+    header[2] = sequence & 0xff;
+    header[3] = sequence >> 8;
+    uint16_t crc = Crc(kRecordStoreCrcSeed, header, segment_header_size - 2);
+    header[4] = crc & 0xff;
+    header[5] = crc >> 8;
+    return Storage::Write(
+        segment_start(segment),
+        header,
+        segment_header_size) == segment_header_size;
+  }
+
+  // Walks through the log of the active segment, and builds the index.
+  static void Scan(uint16_t sequence) {
+    memset(index_, 0xff, sizeof(index_));
+    uint16_t address = segment_start(segment_) + segment_header_size;
+    uint16_t end = segment_end(segment_);
+    while (address + record_overhead <= end) {
+      uint8_t header[record_header_size];
+      Storage::Read(address, record_header_size, header);
+      uint8_t key = header[0];
+      uint8_t size = header[1];
+      if (key >= num_keys ||
+          (header[2] | (header[3] << 8)) != sequence ||
+          address + record_overhead + size > end) {
+        break;
+      }
+      uint16_t crc = Crc(kRecordStoreCrcSeed, header, record_header_size);
+      uint16_t payload = address + record_header_size;
+      uint8_t buffer[chunk_size];
+      while (size) {
+        uint8_t chunk = size > static_cast<uint8_t>(chunk_size) ?
+            static_cast<uint8_t>(chunk_size) : size;
+        Storage::Read(payload, chunk, buffer);
+        crc = Crc(crc, buffer, chunk);
+        payload += chunk;
+        size -= chunk;
+      }
+      uint8_t expected_crc[2];
+      Storage::Read(payload, 2, expected_crc);
+      if (crc != (expected_crc[0] | (expected_crc[1] << 8))) {
+        break;
+      }
+      index_[key] = address;
+      address = payload + 2;
+      ++sequence;
+    }
+    write_ptr_ = address;
+    sequence_ = sequence;
+  }
+
+  // Copies a record, with a new sequence number, to another segment. Returns
+  // the number of bytes written.
+  static uint16_t CopyRecord(
+      uint16_t source,
+      uint16_t destination,
+      uint8_t target_segment,
+      uint16_t sequence) {
+    uint8_t header[record_header_size];
+    Storage::Read(source, record_header_size, header);
+    uint8_t size = header[1];
+    if (destination + record_overhead + size > segment_end(target_segment)) {
+      return 0;
+    }
+    header[2] = sequence & 0xff;
+    header[3] = sequence >> 8;
+    uint16_t crc = Crc(kRecordStoreCrcSeed, header, record_header_size);
+    if (Storage::Write(destination, header, record_header_size) !=
+        record_header_size) {
+      return 0;
+    }
+    source += record_header_size;
+    destination += record_header_size;
+    uint8_t buffer[chunk_size];
+    while (size) {
+      uint8_t chunk = size > static_cast<uint8_t>(chunk_size) ?
+          static_cast<uint8_t>(chunk_size) : size;
+      Storage::Read(source, chunk, buffer);
+      crc = Crc(crc, buffer, chunk);
+      if (Storage::Write(destination, buffer, chunk) != chunk) {
+        return 0;
+      }
+      source += chunk;
+      destination += chunk;
+      size -= chunk;
+    }
+    uint8_t crc_bytes[2];
+    crc_bytes[0] = crc & 0xff;
+    crc_bytes[1] = crc >> 8;
+    if (Storage::Write(destination, crc_bytes, 2) != 2) {
+      return 0;
+    }
+    return header[1] + record_overhead;
+  }
+
+  // Returns 1 if a record already holds the same data.
+  static uint8_t Matches(uint8_t key, const uint8_t* data, uint8_t size) {
+    if (!has_record(key) || RecordStore::size(key) != size) {
+      return 0;
+    }
+    uint16_t address = index_[key] + record_header_size;
+    uint8_t buffer[chunk_size];
+    while (size) {
+      uint8_t chunk = size > static_cast<uint8_t>(chunk_size) ?
+          static_cast<uint8_t>(chunk_size) : size;
+      Storage::Read(address, chunk, buffer);
+      if (memcmp(buffer, data, chunk)) {
+        return 0;
+      }
+      address += chunk;
+      data += chunk;
+      size -= chunk;
+    }
+    return 1;
+  }
+
+  static uint16_t index_[num_keys];
+  static uint16_t write_ptr_;
+  static uint16_t sequence_;
+  static uint8_t segment_;
+
+  DISALLOW_COPY_AND_ASSIGN(RecordStore);
+};
+
+/* static */
+template<typename Storage, uint16_t base_address, uint16_t storage_size,
+         uint8_t num_keys>
+uint16_t RecordStore<Storage, base_address, storage_size,
+                     num_keys>::index_[num_keys];
+
+/* static */
+template<typename Storage, uint16_t base_address, uint16_t storage_size,
+         uint8_t num_keys>
+uint16_t RecordStore<Storage, base_address, storage_size,
+                     num_keys>::write_ptr_;
+
+/* static */
+template<typename Storage, uint16_t base_address, uint16_t storage_size,
+         uint8_t num_keys>
+uint16_t RecordStore<Storage, base_address, storage_size,
+                     num_keys>::sequence_;
+
+/* static */
+template<typename Storage, uint16_t base_address, uint16_t storage_size,
+         uint8_t num_keys>
+uint8_t RecordStore<Storage, base_address, storage_size,
+                    num_keys>::segment_;
+
+}  // namespace avrlib
+
+#endif  // AVRLIB_RECORD_STORE_H_
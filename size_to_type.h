@@ -23,9 +23,17 @@
 
 namespace avrlib {
 
+template<uint8_t num_words>
+struct LargeDataType {
+  typedef uint16_t Type;
+};
+
+template<> struct LargeDataType<1> { typedef uint32_t Type; };
+template<> struct LargeDataType<2> { typedef uint64_t Type; };
+
 template<uint8_t size>
 struct DataTypeForSize {
-  typedef uint16_t Type;
+  typedef typename LargeDataType<(size > 16) + (size > 32)>::Type Type;
 };
 
 template<> struct DataTypeForSize<1> { typedef uint8_t Type; };
@@ -137,6 +137,20 @@ class SpiMaster {
     SPDR = v;
   }
 
+  // Send() waits for the byte to be fully shifted out, so there is nothing to
+  // wait for.
+  static inline void Flush() { }
+
+  // Transfer complete interrupt (SPI_RECEIVE vector), for interrupt-driven
+  // transfers.
+  static inline void EnableTransferInterrupt() {
+    SPCR |= _BV(SPIE);
+  }
+
+  static inline void DisableTransferInterrupt() {
+    SPCR &= ~_BV(SPIE);
+  }
+
   static inline void WriteWord(uint8_t a, uint8_t b) {
     Begin();
     Send(a);
@@ -198,9 +212,22 @@ template<typename XckPort,
          typename ControlRegisterC,
          uint8_t CFlags,
          typename TxReadyBit,
+         typename TxCompleteBit,
+         typename TxCompleteInterruptBit,
          typename DataRegister>
 struct UartSpiPort {
   static inline uint8_t tx_ready() { return TxReadyBit::value(); }
+  static inline uint8_t tx_complete() { return TxCompleteBit::value(); }
+  // A read-modify-write would also clear the flag if it got set in between.
+  // The other bits of UCSRnA are either read-only, or must be kept at 0 in
+  // master SPI mode.
+  static inline void clear_tx_complete() { TxCompleteBit::clear_flag(); }
+  static inline void EnableTxCompleteInterrupt() {
+    TxCompleteInterruptBit::set();
+  }
+  static inline void DisableTxCompleteInterrupt() {
+    TxCompleteInterruptBit::clear();
+  }
   static inline uint8_t data() { return *DataRegister::ptr(); }
   static inline void set_data(uint8_t value) { *DataRegister::ptr() = value; }
   static inline void Setup(uint16_t rate) {
@@ -226,6 +253,8 @@ typedef UartSpiPort<
     UCSR0CRegister,
     _BV(UMSEL01) | _BV(UMSEL00),
     BitInRegister<UCSR0ARegister, UDRE0>,
+    BitInRegister<UCSR0ARegister, TXC0>,
+    BitInRegister<UCSR0BRegister, TXCIE0>,
     UDR0Register> UartSpiPort0;
 
 #endif  // HAS_USART0
@@ -242,6 +271,8 @@ typedef UartSpiPort<
     UCSR1CRegister,
     _BV(UMSEL11) | _BV(UMSEL10),
     BitInRegister<UCSR1ARegister, UDRE1>,
+    BitInRegister<UCSR1ARegister, TXC1>,
+    BitInRegister<UCSR1BRegister, TXCIE1>,
     UDR1Register> UartSpiPort1;
 
 #endif  // HAS_USART1
@@ -290,9 +321,28 @@ class UartSpiMaster {
   
   static inline void OptimisticWait() { }
   
+  // The transmit complete flag is cleared before the data register is filled,
+  // so that it is only set once this byte has been shifted out.
   static inline void Overwrite(uint8_t v) {
+    Port::clear_tx_complete();
     Port::set_data(v);
   }
+
+  // Send() only waits for the transmit buffer to be free. Waits until the last
+  // byte has been shifted out - for example before strobing a latch.
+  static inline void Flush() {
+    while (!Port::tx_complete());
+  }
+
+  // Transmit complete interrupt (USARTn_TX vector), for interrupt-driven
+  // transfers.
+  static inline void EnableTransferInterrupt() {
+    Port::EnableTxCompleteInterrupt();
+  }
+
+  static inline void DisableTransferInterrupt() {
+    Port::DisableTxCompleteInterrupt();
+  }
   
   static inline void WriteWord(uint8_t a, uint8_t b) {
     Begin();
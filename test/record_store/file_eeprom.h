@@ -0,0 +1,157 @@
+// Copyright 2012 Olivier Gillet.
+//
+// Author: Olivier Gillet (ol.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Host-side fake EEPROM, backed by a file, with the same block interface as
+// InternalEeprom and ExternalEeprom.
+//
+// A power failure can be simulated with set_power_budget(): once the given
+// number of bytes has been written, all the subsequent writes are dropped, as
+// if the chip had lost power in the middle of a block. The number of writes
+// to each cell is counted, to estimate the wear.
+
+#ifndef AVRLIB_TEST_RECORD_STORE_FILE_EEPROM_H_
+#define AVRLIB_TEST_RECORD_STORE_FILE_EEPROM_H_
+
+#include <stdio.h>
+#include <string.h>
+
+#include "avrlib/base.h"
+
+namespace avrlib {
+
+static const int32_t kFileEepromUnlimitedPower = -1;
+
+template<uint16_t eeprom_size = 1024>
+class FileEeprom {
+ public:
+  FileEeprom() { }
+
+  // Opens the file, creating it - filled with 0xff, like a blank EEPROM - if
+  // it does not exist.
+  static uint8_t Init(const char* path) {
+    file_ = fopen(path, "r+b");
+    memset(data_, 0xff, eeprom_size);
+    if (file_) {
+      if (fread(data_, 1, eeprom_size, file_) != eeprom_size) {
+        fclose(file_);
+        file_ = NULL;
+      }
+    }
+    if (!file_) {
+      file_ = fopen(path, "w+b");
+      if (!file_ || fwrite(data_, 1, eeprom_size, file_) != eeprom_size) {
+        return 0;
+      }
+      fflush(file_);
+    }
+    memset(wear_, 0, sizeof(wear_));
+    bytes_written_ = 0;
+    power_budget_ = kFileEepromUnlimitedPower;
+    return 1;
+  }
+
+  static void Done() {
+    if (file_) {
+      fclose(file_);
+      file_ = NULL;
+    }
+  }
+
+  static uint16_t Read(uint16_t address, uint16_t size, uint8_t* data) {
+    if (address + size > eeprom_size) {
+      size = address < eeprom_size ? eeprom_size - address : 0;
+    }
+    memcpy(data, &data_[address], size);
+    return size;
+  }
+
+  static uint16_t Write(uint16_t address, const uint8_t* data, uint16_t size) {
+    if (address + size > eeprom_size) {
+      size = address < eeprom_size ? eeprom_size - address : 0;
+    }
+    if (power_budget_ != kFileEepromUnlimitedPower &&
+        size > power_budget_) {
+      size = power_budget_;
+    }
+    for (uint16_t i = 0; i < size; ++i) {
+      data_[address + i] = data[i];
+      ++wear_[address + i];
+    }
+    if (power_budget_ != kFileEepromUnlimitedPower) {
+      power_budget_ -= size;
+    }
+    bytes_written_ += size;
+    if (size) {
+      fseek(file_, address, SEEK_SET);
+      fwrite(&data_[address], 1, size, file_);
+      fflush(file_);
+    }
+    return size;
+  }
+
+  // Number of bytes which can still be written before the simulated power
+  // failure, or kFileEepromUnlimitedPower.
+  static inline void set_power_budget(int32_t budget) {
+    power_budget_ = budget;
+  }
+
+  static inline uint32_t bytes_written() { return bytes_written_; }
+
+  // Largest number of writes to a single cell since Init().
+  static uint32_t max_wear() {
+    uint32_t wear = 0;
+    for (uint16_t i = 0; i < eeprom_size; ++i) {
+      if (wear_[i] > wear) {
+        wear = wear_[i];
+      }
+    }
+    return wear;
+  }
+
+ private:
+  static FILE* file_;
+  static uint8_t data_[eeprom_size];
+  static uint32_t wear_[eeprom_size];
+  static uint32_t bytes_written_;
+  static int32_t power_budget_;
+
+  DISALLOW_COPY_AND_ASSIGN(FileEeprom);
+};
+
+/* static */
+template<uint16_t eeprom_size>
+FILE* FileEeprom<eeprom_size>::file_;
+
+/* static */
+template<uint16_t eeprom_size>
+uint8_t FileEeprom<eeprom_size>::data_[eeprom_size];
+
+/* static */
+template<uint16_t eeprom_size>
+uint32_t FileEeprom<eeprom_size>::wear_[eeprom_size];
+
+/* static */
+template<uint16_t eeprom_size>
+uint32_t FileEeprom<eeprom_size>::bytes_written_;
+
+/* static */
+template<uint16_t eeprom_size>
+int32_t FileEeprom<eeprom_size>::power_budget_;
+
+}  // namespace avrlib
+
+#endif  // AVRLIB_TEST_RECORD_STORE_FILE_EEPROM_H_
@@ -0,0 +1,98 @@
+// Copyright 2012 Olivier Gillet.
+//
+// Author: Olivier Gillet (ol.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Host benchmark of RecordStore against a file-backed fake EEPROM: writes per
+// second, read latency, and EEPROM wear compared to rewriting each setting at
+// a fixed address.
+//
+// The timings measure the host CPU and file system, not an AVR: they are
+// useful to compare versions of the store, not to predict the speed on the
+// target. The wear figures do not depend on the host.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "avrlib/record_store.h"
+#include "avrlib/test/record_store/file_eeprom.h"
+
+using namespace avrlib;
+
+typedef FileEeprom<1024> Eeprom;
+typedef RecordStore<Eeprom, 0, 1024, 16> Store;
+
+static const char* kPath = "record_store_benchmark.bin";
+static const uint32_t kNumWrites = 20000;
+static const uint32_t kNumReads = 200000;
+static const uint8_t kRecordSize = 8;
+
+static double Seconds(clock_t start) {
+  return static_cast<double>(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(void) {
+  remove(kPath);
+  Eeprom::Init(kPath);
+  Store::Init();
+
+  uint8_t data[kRecordSize];
+  memset(data, 0, sizeof(data));
+  clock_t start = clock();
+  for (uint32_t i = 0; i < kNumWrites; ++i) {
+    data[0] = i & 0xff;
+    data[1] = i >> 8;
+    if (!Store::Write(i % 16, data, kRecordSize)) {
+      fprintf(stderr, "Write %u failed\n", static_cast<unsigned>(i));
+      return 1;
+    }
+  }
+  double write_time = Seconds(start);
+
+  uint32_t checksum = 0;
+  start = clock();
+  for (uint32_t i = 0; i < kNumReads; ++i) {
+    Store::Read(i % 16, data, kRecordSize);
+    checksum += data[0];
+  }
+  double read_time = Seconds(start);
+
+  start = clock();
+  for (uint32_t i = 0; i < 100; ++i) {
+    Store::Init();
+  }
+  double init_time = Seconds(start) / 100;
+
+  printf("%u writes of %u bytes: %.0f writes/s\n",
+         static_cast<unsigned>(kNumWrites),
+         kRecordSize,
+         kNumWrites / write_time);
+  printf("Read latency: %.3f us (checksum %u)\n",
+         read_time / kNumReads * 1e6,
+         static_cast<unsigned>(checksum));
+  printf("Init (log scan): %.3f us\n", init_time * 1e6);
+  printf("Bytes written to the EEPROM: %u\n",
+         static_cast<unsigned>(Eeprom::bytes_written()));
+  // Rewriting the 16 settings at fixed addresses would write each of their
+  // cells kNumWrites / 16 times.
+  printf("Most written cell: %u writes (%u at a fixed address)\n",
+         static_cast<unsigned>(Eeprom::max_wear()),
+         static_cast<unsigned>(kNumWrites / 16));
+
+  Eeprom::Done();
+  remove(kPath);
+  return 0;
+}
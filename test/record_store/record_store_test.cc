@@ -0,0 +1,231 @@
+// Copyright 2012 Olivier Gillet.
+//
+// Author: Olivier Gillet (ol.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Host test of RecordStore against a file-backed fake EEPROM: persistence,
+// compaction, power failures at every byte of a write, and Format.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "avrlib/record_store.h"
+#include "avrlib/test/record_store/file_eeprom.h"
+
+using namespace avrlib;
+
+typedef FileEeprom<256> Eeprom;
+// Two segments of 128 bytes: 8 records of 8 bytes fit in a segment.
+typedef RecordStore<Eeprom, 0, 256, 4> Store;
+
+static const char* kPath = "record_store_test.bin";
+static const uint8_t kRecordSize = 8;
+
+static int num_failures = 0;
+
+#define CHECK(condition) \
+  if (!(condition)) { \
+    fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+            #condition); \
+    ++num_failures; \
+  }
+
+static void Fill(uint8_t key, uint8_t version, uint8_t* data) {
+  for (uint8_t i = 0; i < kRecordSize; ++i) {
+    data[i] = key * 16 + version + i;
+  }
+}
+
+// Returns the version stored for a key, or 0xff if the record is missing or
+// does not match any version.
+static uint8_t Version(uint8_t key) {
+  uint8_t data[kRecordSize];
+  if (Store::Read(key, data, kRecordSize) != kRecordSize) {
+    return 0xff;
+  }
+  for (uint8_t version = 0; version < 16; ++version) {
+    uint8_t expected[kRecordSize];
+    Fill(key, version, expected);
+    if (!memcmp(data, expected, kRecordSize)) {
+      return version;
+    }
+  }
+  return 0xff;
+}
+
+static void Put(uint8_t key, uint8_t version) {
+  uint8_t data[kRecordSize];
+  Fill(key, version, data);
+  CHECK(Store::Write(key, data, kRecordSize));
+}
+
+static void Reboot() {
+  Eeprom::Done();
+  Eeprom::Init(kPath);
+  Store::Init();
+}
+
+static void Erase() {
+  Eeprom::Done();
+  remove(kPath);
+  Eeprom::Init(kPath);
+  Store::Init();
+}
+
+static void TestPersistence() {
+  Erase();
+  for (uint8_t key = 0; key < 4; ++key) {
+    CHECK(!Store::has_record(key));
+    Put(key, key + 1);
+  }
+  Reboot();
+  for (uint8_t key = 0; key < 4; ++key) {
+    CHECK(Version(key) == key + 1);
+  }
+
+  // Identical records are not written again.
+  uint32_t written = Eeprom::bytes_written();
+  Put(2, 3);
+  CHECK(Eeprom::bytes_written() == written);
+}
+
+static void TestCompaction() {
+  Erase();
+  // Enough versions to go through both segments several times.
+  for (uint8_t version = 0; version < 16; ++version) {
+    for (uint8_t key = 0; key < 4; ++key) {
+      Put(key, (version + key) & 0x0f);
+    }
+    Reboot();
+    for (uint8_t key = 0; key < 4; ++key) {
+      CHECK(Version(key) == ((version + key) & 0x0f));
+    }
+  }
+  CHECK(Store::Compact());
+  CHECK(Store::free_space() == 128 - 6 - 4 * 14);
+  Reboot();
+  CHECK(Store::free_space() == 128 - 6 - 4 * 14);
+
+  // A record which cannot fit even after compaction is rejected.
+  uint8_t large[128];
+  memset(large, 0, sizeof(large));
+  CHECK(!Store::Write(0, large, 80));
+  CHECK(Version(0) == 15);
+}
+
+// Fills the active segment, so that the next write triggers a compaction.
+static void PrepareFullSegment() {
+  Erase();
+  for (uint8_t key = 0; key < 4; ++key) {
+    Put(key, 1);
+  }
+  for (uint8_t key = 0; key < 4; ++key) {
+    Put(key, 2);
+  }
+  CHECK(Store::free_space() < 14);
+}
+
+static void TestPowerFailure() {
+  // Measures the number of bytes written by an uninterrupted write, which
+  // compacts the store first.
+  PrepareFullSegment();
+  uint32_t before = Eeprom::bytes_written();
+  Put(1, 3);
+  uint32_t total = Eeprom::bytes_written() - before;
+  CHECK(total > 14);
+
+  for (uint32_t budget = 0; budget <= total; ++budget) {
+    PrepareFullSegment();
+    Eeprom::set_power_budget(budget);
+    uint8_t data[kRecordSize];
+    Fill(1, 3, data);
+    Store::Write(1, data, kRecordSize);
+    Reboot();
+    // The interrupted record is either the old or the new version, and the
+    // other records are untouched.
+    uint8_t version = Version(1);
+    CHECK(version == 2 || version == 3);
+    CHECK(budget < total || version == 3);
+    CHECK(Version(0) == 2);
+    CHECK(Version(2) == 2);
+    CHECK(Version(3) == 2);
+    // The store is still usable after the failure.
+    Put(3, 4);
+    Reboot();
+    CHECK(Version(3) == 4);
+  }
+}
+
+static void TestFormat() {
+  // Format from segment 0, then from segment 1.
+  for (uint8_t segment = 0; segment < 2; ++segment) {
+    Erase();
+    for (uint8_t key = 0; key < 4; ++key) {
+      Put(key, 1);
+    }
+    if (segment) {
+      CHECK(Store::Compact());
+    }
+    Store::Format();
+    for (uint8_t key = 0; key < 4; ++key) {
+      CHECK(!Store::has_record(key));
+    }
+    Reboot();
+    for (uint8_t key = 0; key < 4; ++key) {
+      CHECK(!Store::has_record(key));
+    }
+    Put(2, 5);
+    Reboot();
+    CHECK(Version(2) == 5);
+    CHECK(!Store::has_record(0));
+  }
+
+  // A Format interrupted at any byte leaves either the old records, or none.
+  for (uint8_t segment = 0; segment < 2; ++segment) {
+    for (uint32_t budget = 0; budget < 16; ++budget) {
+      Erase();
+      for (uint8_t key = 0; key < 4; ++key) {
+        Put(key, 1);
+      }
+      if (segment) {
+        CHECK(Store::Compact());
+      }
+      Eeprom::set_power_budget(budget);
+      Store::Format();
+      Reboot();
+      uint8_t kept = 0;
+      for (uint8_t key = 0; key < 4; ++key) {
+        kept += Version(key) == 1;
+      }
+      CHECK(kept == 0 || kept == 4);
+      CHECK(budget < 8 || kept == 0);
+    }
+  }
+}
+
+int main(void) {
+  TestPersistence();
+  TestCompaction();
+  TestPowerFailure();
+  TestFormat();
+  Eeprom::Done();
+  remove(kPath);
+  if (num_failures) {
+    fprintf(stderr, "%d check(s) failed\n", num_failures);
+    return 1;
+  }
+  printf("All tests passed\n");
+  return 0;
+}
@@ -26,6 +26,7 @@ namespace avrlib {
 
 volatile LongWord timer0_milliseconds = { 0 };
 uint8_t timer0_fractional = 0;
+volatile LongWord timer0_overflows = { 0 };
 
 uint32_t Delay(uint32_t delay) {
   uint32_t t = milliseconds() + delay;
@@ -41,6 +42,24 @@ uint32_t milliseconds() {
   return m;
 }
 
+uint32_t microseconds() {
+  return TicksToMicroseconds(long_ticks());
+}
+
+uint32_t TicksToMicroseconds(uint32_t ticks) {
+  // One tick is 64 CPU cycles. For clock rates that do not divide 64 (20 MHz),
+  // the multiplication is split to avoid an overflow - the result then loses
+  // its continuity when the tick count wraps, every 3.8 hours.
+  const uint8_t cycles_per_microsecond = F_CPU / 1000000L;
+  if (64 % cycles_per_microsecond == 0) {
+    return ticks * (64 / cycles_per_microsecond);
+  } else {
+    uint32_t q = ticks / cycles_per_microsecond;
+    uint8_t r = ticks % cycles_per_microsecond;
+    return q * 64 + (static_cast<uint16_t>(r) * 64) / cycles_per_microsecond;
+  }
+}
+
 void InitClock() {
   Timer<0>::set_prescaler(3);
   Timer<0>::set_mode(TIMER_FAST_PWM);
@@ -21,12 +21,16 @@
 #define AVRLIB_TIME_H_
 
 #include <avr/delay.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
 
 #include "avrlib/base.h"
 
 namespace avrlib {
 
 uint32_t milliseconds();
+uint32_t microseconds();
+uint32_t TicksToMicroseconds(uint32_t ticks);
 uint32_t Delay(uint32_t delay);
 
 #define ConstantDelay(x) _delay_ms((x))
@@ -49,7 +53,52 @@ extern volatile LongWord timer0_milliseconds;
 
 extern uint8_t timer0_fractional;
 
+// Number of timer0 overflows since startup. Combined with TCNT0 to get
+// timestamps with a resolution of 64 CPU cycles.
+extern volatile LongWord timer0_overflows;
+
+// Timer0 ticks (64 CPU cycles, 4us at 16 MHz) since startup, as a 16-bit
+// value wrapping every 256 overflows. Cheap enough for profiling and for
+// measuring short intervals - using a wrapping subtraction.
+//
+// If the counter has wrapped but the overflow interrupt has not been serviced
+// yet (because interrupts are disabled, or because we have been called from
+// another ISR), TOV0 is set and the overflow count is one behind.
+inline uint16_t ticks() {
+  uint8_t old_sreg = SREG;
+  cli();
+  uint8_t high = timer0_overflows.bytes[0];
+  uint8_t low = TCNT0;
+  if ((TIFR0 & _BV(TOV0)) && low != 0xff) {
+    ++high;
+  }
+  SREG = old_sreg;
+  return (static_cast<uint16_t>(high) << 8) | low;
+}
+
+// Timer0 ticks since startup, as a 32-bit value. microseconds() without the
+// conversion, which is expensive at clock rates that do not divide 64: use
+// this in ISRs, and TicksToMicroseconds() later.
+inline uint32_t long_ticks() {
+  LongWord t;
+  uint8_t old_sreg = SREG;
+  cli();
+  t.value = timer0_overflows.value;
+  uint8_t low = TCNT0;
+  // See ticks() for the handling of a pending overflow.
+  if ((TIFR0 & _BV(TOV0)) && low != 0xff) {
+    ++t.value;
+  }
+  SREG = old_sreg;
+  return (t.value << 8) | low;
+}
+
 inline void TickSystemClock() {
+  // Same trick as below for the overflow counter.
+  ++timer0_overflows.words[0];
+  if (timer0_overflows.words[0] == 0) {
+    ++timer0_overflows.words[1];
+  }
   // Compile-time optimization: with a 20Mhz clock rate, milliseconds_increment
   // is always null, so we have to increment it only when there's a
   // fractional overflow!
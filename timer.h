@@ -30,6 +30,17 @@
 
 namespace avrlib {
 
+#if defined(ATMEGA1284P) || defined(ATMEGA640) || defined(ATMEGA1280) \
+    || defined(ATMEGA2560)
+#define HAS_TIMER3
+#endif
+
+#if defined(ATMEGA640) || defined(ATMEGA1280) || defined(ATMEGA2560)
+#define HAS_TIMER4
+#define HAS_TIMER5
+#define HAS_TIMER_OCR_C
+#endif
+
 SpecialFunctionRegister(TCCR0A);
 SpecialFunctionRegister(TCCR0B);
 SpecialFunctionRegister(TCCR1A);
@@ -39,13 +50,15 @@ SpecialFunctionRegister(TCCR2B);
 SpecialFunctionRegister(TIMSK0);
 SpecialFunctionRegister(TIMSK1);
 SpecialFunctionRegister(TIMSK2);
+SpecialFunctionRegister(TIFR1);
 SpecialFunctionRegister(TCNT0);
 SpecialFunctionRegister16(TCNT1);
 SpecialFunctionRegister(TCNT2);
 SpecialFunctionRegister(OCR0A);
 SpecialFunctionRegister(OCR0B);
-SpecialFunctionRegister(OCR1A);
-SpecialFunctionRegister(OCR1B);
+SpecialFunctionRegister16(OCR1A);
+SpecialFunctionRegister16(OCR1B);
+SpecialFunctionRegister16(ICR1);
 SpecialFunctionRegister(OCR2A);
 SpecialFunctionRegister(OCR2B);
 
@@ -53,11 +66,42 @@ SpecialFunctionRegister(OCR2B);
 SpecialFunctionRegister(TCCR3A);
 SpecialFunctionRegister(TCCR3B);
 SpecialFunctionRegister(TIMSK3);
-SpecialFunctionRegister(TCNT3);
-SpecialFunctionRegister(OCR3A);
-SpecialFunctionRegister(OCR3B);
+SpecialFunctionRegister(TIFR3);
+SpecialFunctionRegister16(TCNT3);
+SpecialFunctionRegister16(OCR3A);
+SpecialFunctionRegister16(OCR3B);
+SpecialFunctionRegister16(ICR3);
 #endif  // HAS_TIMER3
 
+#ifdef HAS_TIMER4
+SpecialFunctionRegister(TCCR4A);
+SpecialFunctionRegister(TCCR4B);
+SpecialFunctionRegister(TIMSK4);
+SpecialFunctionRegister(TIFR4);
+SpecialFunctionRegister16(TCNT4);
+SpecialFunctionRegister16(OCR4A);
+SpecialFunctionRegister16(OCR4B);
+SpecialFunctionRegister16(OCR4C);
+SpecialFunctionRegister16(ICR4);
+#endif  // HAS_TIMER4
+
+#ifdef HAS_TIMER5
+SpecialFunctionRegister(TCCR5A);
+SpecialFunctionRegister(TCCR5B);
+SpecialFunctionRegister(TIMSK5);
+SpecialFunctionRegister(TIFR5);
+SpecialFunctionRegister16(TCNT5);
+SpecialFunctionRegister16(OCR5A);
+SpecialFunctionRegister16(OCR5B);
+SpecialFunctionRegister16(OCR5C);
+SpecialFunctionRegister16(ICR5);
+#endif  // HAS_TIMER5
+
+#ifdef HAS_TIMER_OCR_C
+SpecialFunctionRegister16(OCR1C);
+SpecialFunctionRegister16(OCR3C);
+#endif  // HAS_TIMER_OCR_C
+
 enum TimerMode {
   TIMER_NORMAL = 0,
   TIMER_PWM_PHASE_CORRECT = 1,
@@ -68,12 +112,14 @@ enum TimerMode {
 template<typename ControlRegisterA,
          typename ControlRegisterB,
          typename InterruptRegister,
-         typename ValueRegister>
+         typename ValueRegister,
+         typename T = uint8_t>
 struct TimerImpl {
   typedef ControlRegisterA A;
   typedef ControlRegisterB B;
+  typedef T Value;
 
-  static inline uint8_t value() {
+  static inline T value() {
     return *ValueRegister::ptr();
   }
 
@@ -110,7 +156,7 @@ struct TimerImpl {
     *ControlRegisterB::ptr() = wg_mode_2 | prescaler;
   }
   
-  static inline void set_value(uint16_t value) {
+  static inline void set_value(T value) {
     *ValueRegister::ptr() = value;
   }
 
@@ -129,6 +175,156 @@ struct TimerImpl {
   }
 };
 
+// 16-bit registers of the 16-bit timers share a single TEMP register for
+// their high byte: the high byte must be written first and read last, and the
+// access must not be interrupted by an ISR accessing another 16-bit register
+// of the same timer.
+template<typename Register>
+struct Register16 {
+  static inline uint16_t Read() {
+    volatile uint8_t* p = reinterpret_cast<volatile uint8_t*>(Register::ptr());
+    uint8_t old_sreg = SREG;
+    cli();
+    uint8_t low = p[0];
+    uint8_t high = p[1];
+    SREG = old_sreg;
+    return (static_cast<uint16_t>(high) << 8) | low;
+  }
+
+  static inline void Write(uint16_t value) {
+    volatile uint8_t* p = reinterpret_cast<volatile uint8_t*>(Register::ptr());
+    uint8_t old_sreg = SREG;
+    cli();
+    p[1] = value >> 8;
+    p[0] = value & 0xff;
+    SREG = old_sreg;
+  }
+};
+
+// Placeholder for the OCRnC register on MCUs which do not have it.
+struct NoRegister16 { };
+
+template<>
+struct Register16<NoRegister16> {
+  static inline uint16_t Read() { return 0; }
+  static inline void Write(uint16_t value) { }
+};
+
+// Waveform generation modes for the 16-bit timers, as WGMn3..0.
+enum Timer16Mode {
+  TIMER16_NORMAL = 0,
+  TIMER16_CTC_OCR_A = 4,
+  TIMER16_FAST_PWM_8_BITS = 5,
+  TIMER16_CTC_ICR = 12,
+  TIMER16_FAST_PWM_ICR = 14,
+  TIMER16_FAST_PWM_OCR_A = 15
+};
+
+template<typename ControlRegisterA,
+         typename ControlRegisterB,
+         typename InterruptRegister,
+         typename InterruptFlagRegister,
+         typename ValueRegister,
+         typename InputCaptureRegister,
+         typename CompareRegisterA,
+         typename CompareRegisterB,
+         typename CompareRegisterC = NoRegister16>
+struct Timer16Impl : public TimerImpl<
+    ControlRegisterA,
+    ControlRegisterB,
+    InterruptRegister,
+    ValueRegister,
+    uint16_t> {
+  typedef TimerImpl<
+      ControlRegisterA,
+      ControlRegisterB,
+      InterruptRegister,
+      ValueRegister,
+      uint16_t> Base;
+  using Base::set_mode;
+
+  static inline uint16_t value() {
+    return Register16<ValueRegister>::Read();
+  }
+  static inline void set_value(uint16_t value) {
+    Register16<ValueRegister>::Write(value);
+  }
+  static inline uint16_t icr() {
+    return Register16<InputCaptureRegister>::Read();
+  }
+  static inline void set_icr(uint16_t value) {
+    Register16<InputCaptureRegister>::Write(value);
+  }
+  static inline void set_ocr_a(uint16_t value) {
+    Register16<CompareRegisterA>::Write(value);
+  }
+  static inline void set_ocr_b(uint16_t value) {
+    Register16<CompareRegisterB>::Write(value);
+  }
+  static inline void set_ocr_c(uint16_t value) {
+    Register16<CompareRegisterC>::Write(value);
+  }
+
+  // Returns true if the timer has overflowed, and the overflow interrupt has
+  // not been serviced yet.
+  static inline uint8_t overflow_pending() {
+    return *InterruptFlagRegister::ptr() & _BV(0);
+  }
+
+  // Input capture edge (ICESn) and noise canceler (ICNCn).
+  static inline void set_input_capture_edge(uint8_t rising) {
+    if (rising) {
+      *ControlRegisterB::ptr() |= _BV(6);
+    } else {
+      *ControlRegisterB::ptr() &= ~_BV(6);
+    }
+  }
+  static inline void set_input_capture_noise_canceler(uint8_t enabled) {
+    if (enabled) {
+      *ControlRegisterB::ptr() |= _BV(7);
+    } else {
+      *ControlRegisterB::ptr() &= ~_BV(7);
+    }
+  }
+
+  // Interrupt enable bits for the compare match B and C interrupts.
+  static inline void StartCompareB() {
+    *InterruptRegister::ptr() |= _BV(2);
+  }
+  static inline void StopCompareB() {
+    *InterruptRegister::ptr() &= ~(_BV(2));
+  }
+  static inline void StartCompareC() {
+    *InterruptRegister::ptr() |= _BV(3);
+  }
+  static inline void StopCompareC() {
+    *InterruptRegister::ptr() &= ~(_BV(3));
+  }
+
+  // Sets the WGMn3..0 bits, leaving the compare output modes and the
+  // prescaler untouched.
+  static inline void set_mode(Timer16Mode mode) {
+    *ControlRegisterA::ptr() = (*ControlRegisterA::ptr() & 0xfc) | (mode & 3);
+    *ControlRegisterB::ptr() = (*ControlRegisterB::ptr() & 0xe7) |
+        ((mode & 0x0c) << 1);
+  }
+
+  // Counts from 0 to top included, and resets. The compare match A interrupt
+  // fires at F_CPU / prescaler / (top + 1) Hz.
+  static inline void set_mode_ctc(uint16_t top) {
+    set_mode(TIMER16_CTC_OCR_A);
+    set_ocr_a(top);
+  }
+
+  // Fast PWM with ICRn as top, leaving all 3 compare registers available for
+  // the duty cycles. The overflow interrupt fires at
+  // F_CPU / prescaler / (top + 1) Hz.
+  static inline void set_mode_fast_pwm_icr(uint16_t top) {
+    set_mode(TIMER16_FAST_PWM_ICR);
+    set_icr(top);
+  }
+};
+
 template<int n>
 struct NumberedTimer { };
 
@@ -141,11 +337,20 @@ template<> struct NumberedTimer<0> {
 };
 
 template<> struct NumberedTimer<1> {
-  typedef TimerImpl<
+  typedef Timer16Impl<
       TCCR1ARegister,
       TCCR1BRegister,
       TIMSK1Register,
-      TCNT1Register> Impl;
+      TIFR1Register,
+      TCNT1Register,
+      ICR1Register,
+      OCR1ARegister,
+#ifdef HAS_TIMER_OCR_C
+      OCR1BRegister,
+      OCR1CRegister> Impl;
+#else
+      OCR1BRegister> Impl;
+#endif  // HAS_TIMER_OCR_C
 };
 
 template<> struct NumberedTimer<2> {
@@ -158,18 +363,57 @@ template<> struct NumberedTimer<2> {
 
 #ifdef HAS_TIMER3
 template<> struct NumberedTimer<3> {
-  typedef TimerImpl<
+  typedef Timer16Impl<
       TCCR3ARegister,
       TCCR3BRegister,
       TIMSK3Register,
-      TCNT3Register> Impl;
+      TIFR3Register,
+      TCNT3Register,
+      ICR3Register,
+      OCR3ARegister,
+#ifdef HAS_TIMER_OCR_C
+      OCR3BRegister,
+      OCR3CRegister> Impl;
+#else
+      OCR3BRegister> Impl;
+#endif  // HAS_TIMER_OCR_C
 };
 #endif  // HAS_TIMER3
 
+#ifdef HAS_TIMER4
+template<> struct NumberedTimer<4> {
+  typedef Timer16Impl<
+      TCCR4ARegister,
+      TCCR4BRegister,
+      TIMSK4Register,
+      TIFR4Register,
+      TCNT4Register,
+      ICR4Register,
+      OCR4ARegister,
+      OCR4BRegister,
+      OCR4CRegister> Impl;
+};
+#endif  // HAS_TIMER4
+
+#ifdef HAS_TIMER5
+template<> struct NumberedTimer<5> {
+  typedef Timer16Impl<
+      TCCR5ARegister,
+      TCCR5BRegister,
+      TIMSK5Register,
+      TIFR5Register,
+      TCNT5Register,
+      ICR5Register,
+      OCR5ARegister,
+      OCR5BRegister,
+      OCR5CRegister> Impl;
+};
+#endif  // HAS_TIMER5
+
 template<int n>
 struct Timer {
   typedef typename NumberedTimer<n>::Impl Impl;
-  static inline uint8_t value() { return Impl::value(); }
+  static inline typename Impl::Value value() { return Impl::value(); }
   static inline void Start() { Impl::Start(); }
   static inline void Stop() { Impl::Stop(); }
   static inline void StartInputCapture() { Impl::StartInputCapture(); }
@@ -185,9 +429,39 @@ struct Timer {
   }
 };
 
+// Additional methods for the 16-bit timers (1, 3, 4, 5).
+template<int n>
+struct Timer16 : public Timer<n> {
+  typedef typename NumberedTimer<n>::Impl Impl;
+  using Timer<n>::set_mode;
+  static inline void set_value(uint16_t value) { Impl::set_value(value); }
+  static inline uint16_t icr() { return Impl::icr(); }
+  static inline void set_icr(uint16_t value) { Impl::set_icr(value); }
+  static inline void set_ocr_a(uint16_t value) { Impl::set_ocr_a(value); }
+  static inline void set_ocr_b(uint16_t value) { Impl::set_ocr_b(value); }
+  static inline void set_ocr_c(uint16_t value) { Impl::set_ocr_c(value); }
+  static inline uint8_t overflow_pending() { return Impl::overflow_pending(); }
+  static inline void set_input_capture_edge(uint8_t rising) {
+    Impl::set_input_capture_edge(rising);
+  }
+  static inline void set_input_capture_noise_canceler(uint8_t enabled) {
+    Impl::set_input_capture_noise_canceler(enabled);
+  }
+  static inline void StartCompareB() { Impl::StartCompareB(); }
+  static inline void StopCompareB() { Impl::StopCompareB(); }
+  static inline void StartCompareC() { Impl::StartCompareC(); }
+  static inline void StopCompareC() { Impl::StopCompareC(); }
+  static inline void set_mode(Timer16Mode mode) { Impl::set_mode(mode); }
+  static inline void set_mode_ctc(uint16_t top) { Impl::set_mode_ctc(top); }
+  static inline void set_mode_fast_pwm_icr(uint16_t top) {
+    Impl::set_mode_fast_pwm_icr(top);
+  }
+};
+
 template<typename Timer, uint8_t enabled_flag, typename PwmRegister>
 struct PwmChannel {
   typedef BitInRegister<typename Timer::Impl::A, enabled_flag> EnabledBit;
+  typedef Timer PwmTimer;
   enum {
     has_pwm = 1
   };
@@ -231,10 +505,27 @@ typedef PwmChannel<Timer<2>, COM2B1, OCR2BRegister> PwmChannel2B;
 #define TIMER_1_TICK ISR(TIMER1_OVF_vect)
 #define TIMER_2_TICK ISR(TIMER2_OVF_vect)
 
+#define TIMER_1_COMPARE_A ISR(TIMER1_COMPA_vect)
+#define TIMER_1_CAPTURE ISR(TIMER1_CAPT_vect)
+
 #ifdef HAS_TIMER3
 #define TIMER_3_TICK ISR(TIMER3_OVF_vect)
+#define TIMER_3_COMPARE_A ISR(TIMER3_COMPA_vect)
+#define TIMER_3_CAPTURE ISR(TIMER3_CAPT_vect)
 #endif  // HAS_TIMER3
 
+#ifdef HAS_TIMER4
+#define TIMER_4_TICK ISR(TIMER4_OVF_vect)
+#define TIMER_4_COMPARE_A ISR(TIMER4_COMPA_vect)
+#define TIMER_4_CAPTURE ISR(TIMER4_CAPT_vect)
+#endif  // HAS_TIMER4
+
+#ifdef HAS_TIMER5
+#define TIMER_5_TICK ISR(TIMER5_OVF_vect)
+#define TIMER_5_COMPARE_A ISR(TIMER5_COMPA_vect)
+#define TIMER_5_CAPTURE ISR(TIMER5_CAPT_vect)
+#endif  // HAS_TIMER5
+
 }  // namespace avrlib
 
 #endif   // AVRLIB_TIMER_H_
@@ -0,0 +1,246 @@
+// Copyright 2012 Olivier Gillet.
+//
+// Author: Olivier Gillet (ol.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Software timers for deferred callbacks (LED flashes, blinking, long presses,
+// delayed EEPROM saves...), run from the main loop.
+//
+// This is a hashed timer wheel: time is divided in ticks of
+// 2^resolution_shift ms, and the wheel has num_slots buckets (a power of 2),
+// each holding a doubly-linked list of timers. A timer due in n ticks is
+// inserted in the bucket visited n ticks from now, with a count of the number
+// of full turns of the wheel to wait for. Starting and cancelling a timer are
+// O(1); Process() only walks through the bucket(s) for the elapsed tick(s).
+//
+// The timers are taken from a fixed pool of num_timers slots. Handles carry
+// a generation count, so that cancelling a timer which has already fired is
+// harmless - even if its slot has been reused in the meantime.
+//
+// Usage:
+//
+// TimerWheel<8> timers;
+// TimerHandle blink = timers.Start(500, &ToggleLed, 0, 500);
+// ...
+// while (1) {
+//   timers.Process();
+//   ...
+// }
+
+#ifndef AVRLIB_TIMER_WHEEL_H_
+#define AVRLIB_TIMER_WHEEL_H_
+
+#include "avrlib/base.h"
+#include "avrlib/time.h"
+
+namespace avrlib {
+
+typedef uint16_t TimerHandle;
+
+static const TimerHandle kNoTimer = 0;
+
+typedef void (*TimerCallback)(uint8_t);
+
+template<uint8_t num_timers = 8,
+         uint8_t num_slots = 16,
+         uint8_t resolution_shift = 2>
+class TimerWheel {
+ public:
+  enum {
+    expired_list = num_slots,
+    free_list = num_slots + 1,
+    no_timer = 0xff
+  };
+
+  TimerWheel() { }
+
+  static void Init() {
+    for (uint8_t i = 0; i < num_slots + 2; ++i) {
+      head_[i] = no_timer;
+    }
+    for (uint8_t i = 0; i < num_timers; ++i) {
+      timer_[i].generation = 1;
+      Link(i, free_list);
+    }
+    current_slot_ = 0;
+    last_tick_ = milliseconds() >> resolution_shift;
+  }
+
+  // Calls callback(data) in delay ms, then every period ms if period is not
+  // null. Returns kNoTimer if all the timers are in use.
+  static TimerHandle Start(
+      uint16_t delay,
+      TimerCallback callback,
+      uint8_t data,
+      uint16_t period) {
+    uint8_t index = head_[free_list];
+    if (index == no_timer) {
+      return kNoTimer;
+    }
+    Unlink(index);
+    timer_[index].callback = callback;
+    timer_[index].data = data;
+    timer_[index].period = period;
+    Schedule(index, delay);
+    return handle(index);
+  }
+
+  static inline TimerHandle Start(
+      uint16_t delay,
+      TimerCallback callback,
+      uint8_t data) {
+    return Start(delay, callback, data, 0);
+  }
+
+  static void Cancel(TimerHandle h) {
+    uint8_t index = h >> 8;
+    if (active(h)) {
+      Unlink(index);
+      Free(index);
+    }
+  }
+
+  // Returns true if the timer has not fired yet, or is periodic.
+  static inline uint8_t active(TimerHandle h) {
+    uint8_t index = h >> 8;
+    return h != kNoTimer && index < num_timers &&
+        timer_[index].bucket != free_list &&
+        timer_[index].generation == (h & 0xff);
+  }
+
+  // To be called from the main loop. Runs the callbacks of all the timers
+  // which have expired since the last call.
+  static void Process() {
+    uint16_t now = milliseconds() >> resolution_shift;
+    while (last_tick_ != now) {
+      ++last_tick_;
+      current_slot_ = (current_slot_ + 1) & (num_slots - 1);
+
+      // Timers due now are first moved to the list of expired timers, so that
+      // the callbacks can freely start or cancel any timer - including the
+      // ones in this bucket.
+      uint8_t index = head_[current_slot_];
+      while (index != no_timer) {
+        uint8_t next = timer_[index].next;
+        if (timer_[index].rounds) {
+          --timer_[index].rounds;
+        } else {
+          Unlink(index);
+          Link(index, expired_list);
+        }
+        index = next;
+      }
+
+      while ((index = head_[expired_list]) != no_timer) {
+        Unlink(index);
+        TimerCallback callback = timer_[index].callback;
+        uint8_t data = timer_[index].data;
+        if (timer_[index].period) {
+          Schedule(index, timer_[index].period);
+        } else {
+          Free(index);
+        }
+        (*callback)(data);
+      }
+    }
+  }
+
+ private:
+  struct Timer {
+    TimerCallback callback;
+    uint16_t rounds;
+    uint16_t period;
+    uint8_t data;
+    uint8_t next;
+    uint8_t previous;
+    uint8_t bucket;
+    uint8_t generation;
+  };
+
+  static inline TimerHandle handle(uint8_t index) {
+    return (static_cast<uint16_t>(index) << 8) | timer_[index].generation;
+  }
+
+  static void Schedule(uint8_t index, uint16_t delay) {
+    // Rounded up, without overflowing for delays close to 65535 ms.
+    uint16_t ticks = (delay >> resolution_shift) +
+        ((delay & ((1 << resolution_shift) - 1)) != 0);
+    if (ticks == 0) {
+      ticks = 1;
+    }
+    timer_[index].rounds = (ticks - 1) / num_slots;
+    Link(index, (current_slot_ + ticks) & (num_slots - 1));
+  }
+
+  static void Free(uint8_t index) {
+    ++timer_[index].generation;
+    if (timer_[index].generation == 0) {
+      timer_[index].generation = 1;
+    }
+    Link(index, free_list);
+  }
+
+  static void Link(uint8_t index, uint8_t bucket) {
+    Timer* t = &timer_[index];
+    t->bucket = bucket;
+    t->previous = no_timer;
+    t->next = head_[bucket];
+    if (t->next != no_timer) {
+      timer_[t->next].previous = index;
+    }
+    head_[bucket] = index;
+  }
+
+  static void Unlink(uint8_t index) {
+    Timer* t = &timer_[index];
+    if (t->previous != no_timer) {
+      timer_[t->previous].next = t->next;
+    } else {
+      head_[t->bucket] = t->next;
+    }
+    if (t->next != no_timer) {
+      timer_[t->next].previous = t->previous;
+    }
+  }
+
+  static Timer timer_[num_timers];
+  static uint8_t head_[num_slots + 2];
+  static uint8_t current_slot_;
+  static uint16_t last_tick_;
+
+  DISALLOW_COPY_AND_ASSIGN(TimerWheel);
+};
+
+/* static */
+template<uint8_t num_timers, uint8_t num_slots, uint8_t resolution_shift>
+typename TimerWheel<num_timers, num_slots, resolution_shift>::Timer
+TimerWheel<num_timers, num_slots, resolution_shift>::timer_[num_timers];
+
+/* static */
+template<uint8_t num_timers, uint8_t num_slots, uint8_t resolution_shift>
+uint8_t TimerWheel<num_timers, num_slots, resolution_shift>::head_[
+    num_slots + 2];
+
+/* static */
+template<uint8_t num_timers, uint8_t num_slots, uint8_t resolution_shift>
+uint8_t TimerWheel<num_timers, num_slots, resolution_shift>::current_slot_;
+
+/* static */
+template<uint8_t num_timers, uint8_t num_slots, uint8_t resolution_shift>
+uint16_t TimerWheel<num_timers, num_slots, resolution_shift>::last_tick_;
+
+}  // namespace avrlib
+
+#endif  // AVRLIB_TIMER_WHEEL_H_
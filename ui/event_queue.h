@@ -34,6 +34,9 @@ enum ControlType {
   CONTROL_SWITCH = 3
 };
 
+// Returned by AddEvent() when the queue is full. Never used as a ticket.
+static const uint8_t kEventQueueNoTicket = 0xff;
+
 struct Event {
   uint8_t control_type;
   uint8_t control_id;
@@ -54,13 +57,27 @@ class EventQueue {
   
   static void Flush() {
     events_.Flush();
+    num_pulled_ = num_added_;
   };
   
-  static void AddEvent(uint8_t control_type, uint8_t id, uint8_t data) {
+  // Returns a ticket which can be passed to pending() to check whether the
+  // event has been pulled - as long as less than 127 events have been added
+  // since. The event is dropped, and kEventQueueNoTicket is returned, when the
+  // queue is full.
+  static uint8_t AddEvent(uint8_t control_type, uint8_t id, uint8_t data) {
     Word v;
     v.bytes[0] = (U8ShiftLeft4(control_type) << 2) | (id & 0x3f);
     v.bytes[1] = data;
-    events_.Overwrite(v.value);
+    if (!events_.NonBlockingWrite(v.value)) {
+      return kEventQueueNoTicket;
+    }
+    uint8_t ticket = num_added_;
+    num_added_ = NextTicket(ticket);
+    return ticket;
+  }
+
+  static inline uint8_t pending(uint8_t ticket) {
+    return static_cast<int8_t>(ticket - num_pulled_) >= 0;
   }
   
   static uint8_t available() {
@@ -85,6 +102,7 @@ class EventQueue {
     Event e;
     Word v;
     v.value = events_.ImmediateRead();
+    num_pulled_ = NextTicket(num_pulled_);
     e.control_type = U8ShiftRight4(v.bytes[0]) >> 2;
     e.control_id = v.bytes[0] & 0x3f;
     e.value = v.bytes[1];
@@ -92,8 +110,15 @@ class EventQueue {
   }
   
  private:
+  // The ticket counters skip kEventQueueNoTicket.
+  static inline uint8_t NextTicket(uint8_t ticket) {
+    return ticket == kEventQueueNoTicket - 1 ? 0 : ticket + 1;
+  }
+
   static uint32_t last_event_time_;
   static RingBuffer<Me> events_;
+  static uint8_t num_added_;
+  static uint8_t num_pulled_;
 };
 
 /* static */
@@ -104,6 +129,14 @@ RingBuffer<EventQueue<size> > EventQueue<size>::events_;
 template<uint8_t size>
 uint32_t EventQueue<size>::last_event_time_;
 
+/* static */
+template<uint8_t size>
+uint8_t EventQueue<size>::num_added_;
+
+/* static */
+template<uint8_t size>
+uint8_t EventQueue<size>::num_pulled_;
+
 }  // namespace avrlib
 
 #endif  // AVRLIB_UI_EVENT_QUEUE_H_
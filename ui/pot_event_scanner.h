@@ -0,0 +1,148 @@
+// Copyright 2012 Olivier Gillet.
+//
+// Author: Olivier Gillet (ol.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Adds a CONTROL_POT event to an EventQueue whenever a pot moves by more than
+// a threshold, so that the UI code does not have to compare all the pot
+// values with a cached copy at each iteration of the main loop.
+//
+// Scanner is any pot scanner with a value(index) method, and a resolution
+// (number of bits of the values) - PotScanner, HysteresisPotScanner,
+// MuxedPotScanner, AsyncAdcScanner. The values are shifted right by
+// value_shift to fit in the 8-bit value of an event; by default, by the
+// number of bits in excess of 8.
+//
+// With scanners converting one pot at each call of Read() (PotScanner,
+// HysteresisPotScanner), call Read() instead of Scanner::Read(): only the pot
+// just read is checked, so the cost is constant per conversion. With scanners
+// running from the ADC interrupt (MuxedPotScanner, AsyncAdcScanner), call
+// CheckNext() from the main loop, which checks one pot per call, in turn.
+//
+// While an event for a pot is waiting in the queue, further moves of this pot
+// do not add events - the latest value is sent once the pending event has
+// been pulled.
+
+#ifndef AVRLIB_UI_POT_EVENT_SCANNER_H_
+#define AVRLIB_UI_POT_EVENT_SCANNER_H_
+
+#include <string.h>
+
+#include "avrlib/base.h"
+#include "avrlib/ui/event_queue.h"
+
+namespace avrlib {
+
+template<
+    typename Scanner,
+    typename Queue,
+    uint8_t num_pots,
+    uint8_t threshold = 2,
+    uint8_t value_shift =
+        (Scanner::resolution > 8 ? Scanner::resolution - 8 : 0)>
+class PotEventScanner {
+ public:
+  PotEventScanner() { }
+
+  static inline void Init() {
+    // The shifted values must fit in 8 bits.
+    STATIC_ASSERT(Scanner::resolution <= 8 + value_shift);
+    Scanner::Init();
+    next_ = 0;
+    memset(reported_, 0xff, sizeof(reported_));
+    memset(pending_, 0, sizeof(pending_));
+  }
+
+  // For scanners converting one pot at each call of Read().
+  static inline void Read() {
+    Scanner::Read();
+    Check(Scanner::last_read());
+  }
+
+  // For scanners converting the pots in the background.
+  static inline void CheckNext() {
+    Check(next_);
+    ++next_;
+    if (next_ == num_pots) {
+      next_ = 0;
+    }
+  }
+
+  static void Check(uint8_t index) {
+    uint16_t value = Scanner::value(index);
+    uint8_t mask = 1 << (index & 7);
+    uint8_t* pending = &pending_[index >> 3];
+    if (reported_[index] == 0xffff) {
+      // First reading, used as a reference.
+      reported_[index] = value;
+      return;
+    }
+    if (*pending & mask) {
+      if (Queue::pending(ticket_[index])) {
+        return;
+      }
+      *pending &= ~mask;
+    }
+    int16_t delta = static_cast<int16_t>(value - reported_[index]);
+    if (delta < 0) {
+      delta = -delta;
+    }
+    if (delta >= threshold) {
+      uint8_t ticket = Queue::AddEvent(
+          CONTROL_POT,
+          index,
+          value >> value_shift);
+      // When the queue is full, the change is reported again at the next call.
+      if (ticket != kEventQueueNoTicket) {
+        reported_[index] = value;
+        ticket_[index] = ticket;
+        *pending |= mask;
+      }
+    }
+  }
+
+ private:
+  static uint16_t reported_[num_pots];
+  static uint8_t ticket_[num_pots];
+  static uint8_t pending_[(num_pots + 7) / 8];
+  static uint8_t next_;
+
+  DISALLOW_COPY_AND_ASSIGN(PotEventScanner);
+};
+
+/* static */
+template<typename Scanner, typename Queue, uint8_t num_pots, uint8_t t,
+         uint8_t s>
+uint16_t PotEventScanner<Scanner, Queue, num_pots, t, s>::reported_[num_pots];
+
+/* static */
+template<typename Scanner, typename Queue, uint8_t num_pots, uint8_t t,
+         uint8_t s>
+uint8_t PotEventScanner<Scanner, Queue, num_pots, t, s>::ticket_[num_pots];
+
+/* static */
+template<typename Scanner, typename Queue, uint8_t num_pots, uint8_t t,
+         uint8_t s>
+uint8_t PotEventScanner<Scanner, Queue, num_pots, t, s>::pending_[
+    (num_pots + 7) / 8];
+
+/* static */
+template<typename Scanner, typename Queue, uint8_t num_pots, uint8_t t,
+         uint8_t s>
+uint8_t PotEventScanner<Scanner, Queue, num_pots, t, s>::next_;
+
+}  // namespace avrlib
+
+#endif  // AVRLIB_UI_POT_EVENT_SCANNER_H_
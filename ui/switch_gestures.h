@@ -0,0 +1,270 @@
+// Copyright 2012 Olivier Gillet.
+//
+// Author: Olivier Gillet (ol.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Recognition of switch gestures (click, double click, long press, auto-repeat
+// while held, chords), posted as CONTROL_SWITCH events into an EventQueue.
+// The value of the event is a SwitchGesture.
+//
+// The state of all the switches is kept in bitmasks, with a single set of
+// timestamps: long presses and auto-repeat are tracked for the switch pressed
+// last, double clicks for the switch released last. This is enough for a
+// front panel operated with one or two fingers, and handles up to 64 switches
+// (the maximum control id of the EventQueue) for the cost of a few words.
+//
+// Process() is called from the main loop with the debounced state of the
+// switches, a bit set when a switch is held. With order = LSB_FIRST, switch i
+// is bit i. With order = MSB_FIRST, switch i is bit num_switches - 1 - i, which
+// is the layout of DebouncedSwitches (active low):
+//
+// typedef SwitchGestures<Queue, 8, 600, 250, 80, MSB_FIRST> Gestures;
+// Gestures::Process(~Switches::debounced());
+//
+// When double clicks are enabled, the CLICKED event of a single click is
+// delayed by double_click_time. Set double_click_time to 0 to disable them and
+// get the CLICKED events immediately.
+
+#ifndef AVRLIB_UI_SWITCH_GESTURES_H_
+#define AVRLIB_UI_SWITCH_GESTURES_H_
+
+#include "avrlib/avrlib.h"
+#include "avrlib/base.h"
+#include "avrlib/size_to_type.h"
+#include "avrlib/time.h"
+#include "avrlib/ui/event_queue.h"
+
+namespace avrlib {
+
+enum SwitchGesture {
+  SWITCH_PRESSED,
+  SWITCH_RELEASED,  // After a long press or a chord.
+  SWITCH_CLICKED,
+  SWITCH_DOUBLE_CLICKED,
+  SWITCH_LONG_PRESSED,
+  SWITCH_REPEATED,
+  // Switch pressed while another one is held. The id of the other switch is
+  // in the lower 6 bits of the value.
+  SWITCH_CHORD = 0x80
+};
+
+// The times are in ms. A repeat_time of 0 disables auto-repeat.
+template<
+    typename Queue,
+    uint8_t num_switches = 8,
+    uint16_t long_press_time = 600,
+    uint16_t double_click_time = 250,
+    uint16_t repeat_time = 80,
+    DataOrder order = LSB_FIRST>
+class SwitchGestures {
+ public:
+  typedef typename DataTypeForSize<num_switches>::Type T;
+
+  SwitchGestures() { }
+
+  static void Init() {
+    held_ = 0;
+    chorded_ = 0;
+    long_pressed_ = 0;
+    last_pressed_ = 0;
+    clicked_ = 0;
+    double_clicked_ = 0;
+  }
+
+  static void Process(T state) {
+    uint16_t now = milliseconds();
+    T pressed = state & ~held_;
+    T released = held_ & ~state;
+    held_ = state;
+
+    // No second press within the double click window.
+    if (clicked_ &&
+        static_cast<uint16_t>(now - release_time_) >= double_click_time) {
+      Flush();
+    }
+
+    if (released) {
+      T mask = 1;
+      for (uint8_t i = 0; i < num_switches; ++i, mask <<= 1) {
+        if (released & mask) {
+          Release(Id(i), mask, now);
+        }
+      }
+    }
+
+    if (pressed) {
+      T mask = 1;
+      for (uint8_t i = 0; i < num_switches; ++i, mask <<= 1) {
+        if (pressed & mask) {
+          Press(Id(i), mask, now);
+        }
+      }
+    }
+
+    // Long press and auto-repeat of the switch pressed last, if still held
+    // on its own.
+    T solo = last_pressed_ & held_ & ~chorded_;
+    if (!solo) {
+      return;
+    }
+    if (!(long_pressed_ & solo)) {
+      if (static_cast<uint16_t>(now - press_time_) >= long_press_time) {
+        long_pressed_ |= solo;
+        double_clicked_ &= ~solo;
+        next_repeat_time_ = now + repeat_time;
+        Queue::AddEvent(CONTROL_SWITCH, Index(solo), SWITCH_LONG_PRESSED);
+      }
+    } else if (repeat_time &&
+               static_cast<int16_t>(now - next_repeat_time_) >= 0) {
+      next_repeat_time_ += repeat_time;
+      Queue::AddEvent(CONTROL_SWITCH, Index(solo), SWITCH_REPEATED);
+    }
+  }
+
+  static inline T held() { return held_; }
+
+ private:
+  static void Press(uint8_t index, T mask, uint16_t now) {
+    Queue::AddEvent(CONTROL_SWITCH, index, SWITCH_PRESSED);
+    T others = held_ & ~mask;
+    if (others) {
+      chorded_ |= others | mask;
+      Flush();
+      double_clicked_ = 0;
+      Queue::AddEvent(CONTROL_SWITCH, index, SWITCH_CHORD | Index(others));
+    } else if (clicked_ == mask) {
+      clicked_ = 0;
+      double_clicked_ = mask;
+    } else {
+      Flush();
+    }
+    last_pressed_ = mask;
+    press_time_ = now;
+  }
+
+  static void Release(uint8_t index, T mask, uint16_t now) {
+    if ((chorded_ | long_pressed_) & mask) {
+      chorded_ &= ~mask;
+      long_pressed_ &= ~mask;
+      Queue::AddEvent(CONTROL_SWITCH, index, SWITCH_RELEASED);
+    } else if (double_clicked_ & mask) {
+      double_clicked_ = 0;
+      Queue::AddEvent(CONTROL_SWITCH, index, SWITCH_DOUBLE_CLICKED);
+    } else if (!double_click_time) {
+      Queue::AddEvent(CONTROL_SWITCH, index, SWITCH_CLICKED);
+    } else {
+      Flush();
+      clicked_ = mask;
+      release_time_ = now;
+    }
+  }
+
+  // Posts the click waiting for a second click.
+  static void Flush() {
+    if (clicked_) {
+      Queue::AddEvent(CONTROL_SWITCH, Index(clicked_), SWITCH_CLICKED);
+      clicked_ = 0;
+    }
+  }
+
+  // Id of the switch of a bit.
+  static inline uint8_t Id(uint8_t bit) {
+    return order == MSB_FIRST ? num_switches - 1 - bit : bit;
+  }
+
+  // Id of the switch of the lowest bit set, or 0 if no bit is set.
+  static uint8_t Index(T mask) {
+    if (!mask) {
+      return 0;
+    }
+    uint8_t index = 0;
+    while (!(mask & 0xff)) {
+      mask >>= 8;
+      index += 8;
+    }
+    while (!(mask & 1)) {
+      mask >>= 1;
+      ++index;
+    }
+    return Id(index);
+  }
+
+  static T held_;
+  static T chorded_;
+  static T long_pressed_;
+  static T last_pressed_;
+  static T clicked_;
+  static T double_clicked_;
+  static uint16_t press_time_;
+  static uint16_t release_time_;
+  static uint16_t next_repeat_time_;
+
+  DISALLOW_COPY_AND_ASSIGN(SwitchGestures);
+};
+
+/* static */
+template<typename Queue, uint8_t n, uint16_t l, uint16_t d, uint16_t r,
+         DataOrder o>
+typename SwitchGestures<Queue, n, l, d, r, o>::T
+SwitchGestures<Queue, n, l, d, r, o>::held_;
+
+/* static */
+template<typename Queue, uint8_t n, uint16_t l, uint16_t d, uint16_t r,
+         DataOrder o>
+typename SwitchGestures<Queue, n, l, d, r, o>::T
+SwitchGestures<Queue, n, l, d, r, o>::chorded_;
+
+/* static */
+template<typename Queue, uint8_t n, uint16_t l, uint16_t d, uint16_t r,
+         DataOrder o>
+typename SwitchGestures<Queue, n, l, d, r, o>::T
+SwitchGestures<Queue, n, l, d, r, o>::long_pressed_;
+
+/* static */
+template<typename Queue, uint8_t n, uint16_t l, uint16_t d, uint16_t r,
+         DataOrder o>
+typename SwitchGestures<Queue, n, l, d, r, o>::T
+SwitchGestures<Queue, n, l, d, r, o>::last_pressed_;
+
+/* static */
+template<typename Queue, uint8_t n, uint16_t l, uint16_t d, uint16_t r,
+         DataOrder o>
+typename SwitchGestures<Queue, n, l, d, r, o>::T
+SwitchGestures<Queue, n, l, d, r, o>::clicked_;
+
+/* static */
+template<typename Queue, uint8_t n, uint16_t l, uint16_t d, uint16_t r,
+         DataOrder o>
+typename SwitchGestures<Queue, n, l, d, r, o>::T
+SwitchGestures<Queue, n, l, d, r, o>::double_clicked_;
+
+/* static */
+template<typename Queue, uint8_t n, uint16_t l, uint16_t d, uint16_t r,
+         DataOrder o>
+uint16_t SwitchGestures<Queue, n, l, d, r, o>::press_time_;
+
+/* static */
+template<typename Queue, uint8_t n, uint16_t l, uint16_t d, uint16_t r,
+         DataOrder o>
+uint16_t SwitchGestures<Queue, n, l, d, r, o>::release_time_;
+
+/* static */
+template<typename Queue, uint8_t n, uint16_t l, uint16_t d, uint16_t r,
+         DataOrder o>
+uint16_t SwitchGestures<Queue, n, l, d, r, o>::next_repeat_time_;
+
+}  // namespace avrlib
+
+#endif  // AVRLIB_UI_SWITCH_GESTURES_H_